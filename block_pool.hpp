@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+// per thread free lists of fixed size blocks (64/128/256 bytes), used for
+// the small objects created on every request (out-of-line callbacks,
+// shared_ptr control blocks...), so that the steady state does not hit malloc
+// a block goes to the list of the thread freeing it, which is not always
+// the one that allocated it (a callback post()ed to a reactor, a task run
+// by a worker); a thread that frees more than it allocates would keep
+// all of them, so the lists are capped and the rest is deleted
+struct small_block_pool {
+    static constexpr size_t _classes = 3;
+    static constexpr size_t _min_block = 64;
+    static constexpr size_t _max_block = _min_block << (_classes - 1);
+    // per class and thread, at most 256 KiB of the largest blocks
+    static constexpr size_t _max_free = 1024;
+
+    struct _free_block {
+        _free_block *m_next;
+    };
+
+    // trivially destructible, so still usable while the thread exits
+    static inline thread_local _free_block *t_free[_classes] = {};
+    static inline thread_local size_t t_count[_classes] = {};
+    static inline thread_local bool t_dead = false;
+
+    struct _thread_guard {
+        _thread_guard() = default;
+        _thread_guard(_thread_guard &&) = delete;
+
+        ~_thread_guard() {
+            t_dead = true;
+            for (auto &head: t_free) {
+                while (head) {
+                    ::operator delete(std::exchange(head, head->m_next));
+                }
+            }
+        }
+    };
+
+    static size_t _class_of(size_t n) noexcept {
+        size_t c = 0;
+        while ((_min_block << c) < n) {
+            ++c;
+        }
+        return c;
+    }
+
+    static void *allocate(size_t n) {
+        if (n > _max_block) {
+            return ::operator new(n);
+        }
+        size_t c = _class_of(n);
+        if (_free_block *block = t_free[c]) {
+            t_free[c] = block->m_next;
+            --t_count[c];
+            return block;
+        }
+        _register_thread();
+        return ::operator new(_min_block << c);
+    }
+
+    // the lists are freed when the thread exits
+    static void _register_thread() {
+        static thread_local _thread_guard guard;
+    }
+
+    static void deallocate(void *p, size_t n) noexcept {
+        if (n > _max_block || t_dead) {
+            return ::operator delete(p);
+        }
+        size_t c = _class_of(n);
+        if (t_count[c] >= _max_free) {
+            return ::operator delete(p);
+        }
+        if (!t_free[c]) {
+            // a thread may free blocks without having allocated any
+            _register_thread();
+        }
+        auto block = static_cast<_free_block *>(p);
+        block->m_next = t_free[c];
+        t_free[c] = block;
+        ++t_count[c];
+    }
+};
+
+// std allocator over small_block_pool, e.g. for allocate_shared / the
+// control block of a shared_ptr with a custom deleter
+template <class T>
+struct block_pool_allocator {
+    using value_type = T;
+
+    block_pool_allocator() = default;
+
+    template <class U>
+    block_pool_allocator(block_pool_allocator<U> const &) noexcept {}
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(small_block_pool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) noexcept {
+        small_block_pool::deallocate(p, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(block_pool_allocator<U> const &) const noexcept {
+        return true;
+    }
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
+#include <vector>
+#include "callback.hpp"
+#include "io_context.hpp"
+#include "stop_source.hpp"
+
+// what to do with a subscriber whose backlog of unsent bytes is over its
+// limit: skip events (it has to notice the gap and catch up by itself), or
+// disconnect it
+enum class backlog_policy {
+    drop,
+    disconnect,
+};
+
+// fans events out to subscribers on every reactor: the publisher encodes an
+// event once, into an immutable Event, and every subscriber is handed that
+// same shared object and queues its bytes as they are (e.g. long-polls,
+// websockets or event streams waiting for the next message)
+// the subscribers are kept per reactor, publish() queues the event in the
+// inbox of every reactor that has some and posts it only if the inbox was
+// empty; the events of the inbox are delivered in one batch, so that a
+// subscriber can write them at once; a subscriber costs a list node, however
+// many events go by
+template <class Event>
+struct broadcaster {
+    using event_pointer = std::shared_ptr<Event const>;
+    // events in publish order
+    using event_span = std::span<event_pointer const>;
+
+    struct _subscriber {
+        callback<event_span> m_deliver;
+        stop_source m_stop;
+        // the first event it gets, the events published before are not
+        // delivered even if they are still in the inbox
+        std::uint64_t m_from = 0;
+        bool m_once = false;
+        // stopped while being delivered to
+        bool m_stopped = false;
+    };
+
+    // the subscribers of one reactor, m_inbox and m_count are under the
+    // broadcaster's lock, the rest is only touched on the reactor
+    struct _local {
+        io_context *m_ctx = nullptr;
+        std::list<_subscriber> m_subscribers;
+        // the subscriber after the one being delivered to, a subscriber
+        // removed during delivery moves it on
+        typename std::list<_subscriber>::iterator m_next;
+        // the events and their numbers, m_delivering is the inbox swapped
+        // out, they keep their capacity
+        std::vector<event_pointer> m_inbox;
+        std::vector<std::uint64_t> m_inbox_numbers;
+        std::vector<event_pointer> m_delivering;
+        std::vector<std::uint64_t> m_delivering_numbers;
+        size_t m_count = 0;
+    };
+
+    std::mutex m_lock;
+    // one per reactor that has subscribed, the reactors must outlive the
+    // broadcaster
+    std::vector<std::unique_ptr<_local>> m_locals;
+    // the number of the next event
+    std::uint64_t m_published = 0;
+
+    broadcaster() = default;
+    broadcaster(broadcaster &&) = delete;
+
+    // deliver runs on this reactor with every event published from now on,
+    // a batch at a time, until stop is requested
+    void subscribe(callback<event_span> deliver, stop_source stop) {
+        if (stop.stop_requested()) {
+            return;
+        }
+        _add(std::move(deliver), stop, false);
+    }
+
+    // call runs once on this reactor, with the next batch of events
+    // published, or with none after dt or once the returned stop_source is
+    // stopped
+    stop_source wait_for(std::chrono::steady_clock::duration dt,
+                         callback<event_span> call) {
+        stop_source stop(std::in_place);
+        stop_source stop_timer(std::in_place);
+        io_context::get().set_timeout(
+            dt, [stop] { stop.request_stop(); }, stop_timer);
+        _add(
+            [stop_timer, call = std::move(call)](event_span events) mutable {
+                // cancel the timer, if it is not what ended the wait
+                stop_timer.request_stop();
+                call(events);
+            },
+            stop, true);
+        return stop;
+    }
+
+    // thread safe, every reactor gets the events in publish order
+    void publish(event_pointer event) {
+        std::lock_guard guard(m_lock);
+        std::uint64_t number = m_published++;
+        for (auto &local: m_locals) {
+            if (local->m_count == 0) {
+                continue;
+            }
+            local->m_inbox.push_back(event);
+            local->m_inbox_numbers.push_back(number);
+            if (local->m_inbox.size() == 1) {
+                local->m_ctx->post([this, local = local.get()] { _drain(*local); });
+            }
+        }
+    }
+
+    // thread safe, e.g. to skip encoding an event nobody waits for
+    bool has_subscribers() {
+        std::lock_guard guard(m_lock);
+        for (auto &local: m_locals) {
+            if (local->m_count != 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void _add(callback<event_span> deliver, stop_source stop, bool once) {
+        io_context *ctx = &io_context::get();
+        std::lock_guard guard(m_lock);
+        _local &local = _get_local(ctx);
+        local.m_subscribers.push_back(
+            {std::move(deliver), stop, m_published, once, false});
+        ++local.m_count;
+        auto it = std::prev(local.m_subscribers.end());
+        stop.set_stop_callback([this, &local, it] {
+            if (!it->m_deliver) {
+                // being delivered to, erased once the call returns
+                it->m_stopped = true;
+                return;
+            }
+            auto deliver = std::move(it->m_deliver);
+            bool once = it->m_once;
+            _erase(local, it);
+            if (once) {
+                deliver({});
+            }
+        });
+    }
+
+    void _erase(_local &local,
+                typename std::list<_subscriber>::iterator it) {
+        if (local.m_next == it) {
+            ++local.m_next;
+        }
+        local.m_subscribers.erase(it);
+        std::lock_guard guard(m_lock);
+        --local.m_count;
+    }
+
+    void _drain(_local &local) {
+        {
+            std::lock_guard guard(m_lock);
+            local.m_delivering.swap(local.m_inbox);
+            local.m_delivering_numbers.swap(local.m_inbox_numbers);
+        }
+        auto &numbers = local.m_delivering_numbers;
+        auto &subscribers = local.m_subscribers;
+        for (auto it = subscribers.begin(); it != subscribers.end();
+             it = local.m_next) {
+            local.m_next = std::next(it);
+            // the events published since it subscribed
+            size_t from = static_cast<size_t>(
+                std::lower_bound(numbers.begin(), numbers.end(), it->m_from) -
+                numbers.begin());
+            if (from == numbers.size()) {
+                continue;
+            }
+            event_span events(local.m_delivering.data() + from,
+                              local.m_delivering.size() - from);
+            if (!it->m_once) {
+                // moved out for the call, which may stop the subscriber
+                auto deliver = std::move(it->m_deliver);
+                deliver(multishot_call, events);
+                if (it->m_stopped) {
+                    _erase(local, it);
+                } else {
+                    it->m_deliver = std::move(deliver);
+                }
+                continue;
+            }
+            auto deliver = std::move(it->m_deliver);
+            it->m_stop.clear_stop_callback();
+            _erase(local, it);
+            deliver(events);
+        }
+        local.m_next = subscribers.end();
+        local.m_delivering.clear();
+        local.m_delivering_numbers.clear();
+    }
+
+    // under m_lock
+    _local &_get_local(io_context *ctx) {
+        for (auto &local: m_locals) {
+            if (local->m_ctx == ctx) {
+                return *local;
+            }
+        }
+        auto &local = m_locals.emplace_back(std::make_unique<_local>());
+        local->m_ctx = ctx;
+        local->m_next = local->m_subscribers.end();
+        return *local;
+    }
+};
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <new>
 #include <type_traits>
 #include <utility>
 #include <memory>
+#include "block_pool.hpp"
 
 inline constexpr struct multishot_call_t {
     explicit multishot_call_t() = default;
@@ -13,30 +16,81 @@ template <class... Args>
 struct callback {
     struct _callback_base {
         virtual void _call(Args... args) = 0;
-        virtual ~_callback_base() = default;
+        // move the functor into the inline storage dst, destroying this
+        virtual _callback_base *_relocate(void *dst) noexcept = 0;
+        // move the functor out to a pool block, destroying this
+        virtual _callback_base *_leak() = 0;
+        virtual void _destroy(bool is_inline) noexcept = 0;
+
+    protected:
+        ~_callback_base() = default;
     };
 
     template <class F>
     struct _callback_impl final : _callback_base {
         F m_func;
-        
+
         template<class... Ts,
                  class = std::enable_if_t<std::is_constructible_v<F, Ts...>>>
         _callback_impl(Ts &&...ts) : m_func(std::forward<Ts>(ts)...) {}
 
         void _call(Args... args) override {
             m_func(std::forward<Args>(args)...);
-        }        
+        }
+
+        _callback_base *_relocate(void *dst) noexcept override {
+            auto moved = ::new (dst) _callback_impl(std::move(m_func));
+            this->~_callback_impl();
+            return moved;
+        }
+
+        _callback_base *_leak() override {
+            void *mem = small_block_pool::allocate(sizeof(_callback_impl));
+            auto moved = ::new (mem) _callback_impl(std::move(m_func));
+            this->~_callback_impl();
+            return moved;
+        }
+
+        void _destroy(bool is_inline) noexcept override {
+            this->~_callback_impl();
+            if (!is_inline) {
+                small_block_pool::deallocate(this, sizeof(_callback_impl));
+            }
+        }
     };
 
-    std::unique_ptr<_callback_base> m_base;
+    // a lambda capturing up to 48 bytes is stored inline, without allocation
+    static constexpr size_t _inline_size = 48 + sizeof(void *);
+
+    template <class F>
+    static constexpr bool _fits_inline =
+        sizeof(_callback_impl<F>) <= _inline_size &&
+        alignof(_callback_impl<F>) <= alignof(void *) &&
+        std::is_nothrow_move_constructible_v<F>;
+
+    // zeroed: gcc cannot tell that an inline callback was constructed in
+    // it before _take() reads it back (-Wmaybe-uninitialized)
+    alignas(void *) unsigned char m_storage[_inline_size] = {};
+    _callback_base *m_base = nullptr;
 
     template <class F, class = std::enable_if_t<
                                std::is_invocable_v<F, Args...> &&
                                !std::is_same_v<std::decay_t<F>, callback>>>
-    callback(F &&f)
-        : m_base(std::make_unique<_callback_impl<std::decay_t<F>>>(
-            std::forward<F>(f))) {}
+    callback(F &&f) {
+        using Impl = _callback_impl<std::decay_t<F>>;
+        static_assert(alignof(Impl) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+        if constexpr (_fits_inline<std::decay_t<F>>) {
+            m_base = ::new (static_cast<void *>(m_storage)) Impl(std::forward<F>(f));
+        } else {
+            void *mem = small_block_pool::allocate(sizeof(Impl));
+            try {
+                m_base = ::new (mem) Impl(std::forward<F>(f));
+            } catch (...) {
+                small_block_pool::deallocate(mem, sizeof(Impl));
+                throw;
+            }
+        }
+    }
 
     callback() = default;
 
@@ -44,13 +98,46 @@ struct callback {
 
     callback(callback const &) = delete;
     callback &operator = (callback const &) = delete;
-    callback(callback &&) = default;
-    callback &operator = (callback &&) = default;
+
+    callback(callback &&that) noexcept {
+        _take(that);
+    }
+
+    callback &operator = (callback &&that) noexcept {
+        if (this != &that) {
+            _reset();
+            _take(that);
+        }
+        return *this;
+    }
+
+    ~callback() {
+        _reset();
+    }
+
+    bool _is_inline() const noexcept {
+        return static_cast<void const *>(m_base) == m_storage;
+    }
+
+    void _take(callback &that) noexcept {
+        if (that._is_inline()) {
+            m_base = that.m_base->_relocate(m_storage);
+        } else {
+            m_base = that.m_base;
+        }
+        that.m_base = nullptr;
+    }
+
+    void _reset() noexcept {
+        if (_callback_base *base = std::exchange(m_base, nullptr)) {
+            base->_destroy(static_cast<void const *>(base) == m_storage);
+        }
+    }
 
     void operator()(Args... args) {
         assert(m_base);
         m_base->_call(std::forward<Args>(args)...);
-        m_base = nullptr;
+        _reset();
     }
 
     void operator()(multishot_call_t, Args... args) const {
@@ -58,22 +145,28 @@ struct callback {
         m_base->_call(std::forward<Args>(args)...);
     }
 
+    // the address of an inline callback is only valid until it is moved,
+    // use leak_addresss() for an address that outlives this object
     void *get_address() const noexcept {
-        return static_cast<void *>(m_base.get());
+        return static_cast<void *>(m_base);
     }
 
-    void *leak_addresss() noexcept {
-        return static_cast<void *>(m_base.release());
+    // a leaked callback always lives in a pool block, and can be taken
+    // back by from_address()
+    void *leak_addresss() {
+        if (m_base && _is_inline()) {
+            m_base = m_base->_leak();
+        }
+        return static_cast<void *>(std::exchange(m_base, nullptr));
     }
 
     static callback from_address(void *addr) noexcept {
         callback call;
-        call.m_base = std::unique_ptr<_callback_base>(
-            static_cast<_callback_base *>(addr));
+        call.m_base = static_cast<_callback_base *>(addr);
         return call;
     }
 
     explicit operator bool() const noexcept {
         return m_base != nullptr;
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "bytes_buffer.hpp"
+#include "callback.hpp"
+#include "io_context.hpp"
+#include "stop_source.hpp"
+#include "write_queue.hpp"
+
+// the body of a text/event-stream response (server-sent events, html
+// living standard 9.2), once its headers are written: events are written as
+// they are sent, until either side closes the connection
+// a comment is written when nothing else was for a heartbeat interval, it
+// keeps proxies from timing the stream out and shows a dead peer; send()
+// returns false once the unsent bytes reach the high water mark (the
+// socket buffer is full), on_drain() tells when they are back under it
+struct event_stream : std::enable_shared_from_this<event_stream>,
+                      write_queue<event_stream> {
+    using pointer = std::shared_ptr<event_stream>;
+
+    // the read side, write_queue writes through a dup() of it
+    async_file m_conn;
+    // the client sends nothing, what it does is read to notice the close
+    bytes_buffer m_readbuf{256};
+
+    size_t m_high_water = 64 * 1024;
+    // send() returned false, on_drain is due
+    bool m_full = false;
+
+    stop_source m_stop_read{std::in_place};
+    stop_source m_stop_heartbeat;
+    std::chrono::steady_clock::duration m_heartbeat_interval = std::chrono::seconds(15);
+    // an event was sent since the last heartbeat
+    bool m_sent = false;
+    // m_bytes_written at the last heartbeat
+    std::uint64_t m_heartbeat_written = 0;
+
+    // close() was called, the socket is closed once the queue is written
+    bool m_ending = false;
+    bool m_closed = false;
+
+    callback<event_stream &> m_on_drain;
+    callback<event_stream &> m_on_close;
+
+    static pointer make() {
+        return std::make_shared<event_stream>();
+    }
+
+    // once send() has returned false, when the unsent bytes are back under
+    // the high water mark
+    void on_drain(callback<event_stream &> call) {
+        m_on_drain = std::move(call);
+    }
+
+    // once the socket is closed, by either side
+    void on_close(callback<event_stream &> call) {
+        m_on_close = std::move(call);
+    }
+
+    void set_heartbeat_interval(std::chrono::steady_clock::duration dt) {
+        m_heartbeat_interval = dt;
+    }
+
+    void set_high_water_mark(size_t n) {
+        m_high_water = n;
+    }
+
+    bool is_closed() const noexcept {
+        return m_closed;
+    }
+
+    bool writable() const noexcept {
+        return !m_closed && !m_ending && m_buffered < m_high_water;
+    }
+
+    // an event as it is written, the same for every client; a line of
+    // data per line of data, event and id must not hold a newline
+    static std::string make_event(std::string_view data,
+                                  std::string_view event = {},
+                                  std::string_view id = {}) {
+        std::string text;
+        text.reserve(data.size() + event.size() + id.size() + 24);
+        if (!id.empty()) {
+            text.append("id: ").append(id).push_back('\n');
+        }
+        if (!event.empty()) {
+            text.append("event: ").append(event).push_back('\n');
+        }
+        while (true) {
+            auto line = data.substr(0, data.find('\n'));
+            text.append("data: ").append(line).push_back('\n');
+            if (line.size() == data.size()) {
+                break;
+            }
+            data.remove_prefix(line.size() + 1);
+        }
+        text.push_back('\n');
+        return text;
+    }
+
+    // false once the producer should wait for on_drain
+    bool send(std::string_view data, std::string_view event = {},
+              std::string_view id = {}) {
+        if (m_ending || m_closed) {
+            return false;
+        }
+        _queue({make_event(data, event, id), nullptr});
+        m_sent = true;
+        _flush();
+        return _check_full();
+    }
+
+    // an event from make_event(), shared with other streams
+    bool send_event(std::shared_ptr<std::string const> event) {
+        if (m_ending || m_closed) {
+            return false;
+        }
+        _queue({{}, std::move(event)});
+        m_sent = true;
+        _flush();
+        return _check_full();
+    }
+
+    // ends the stream once what is queued is written
+    void close() {
+        if (m_ending || m_closed) {
+            return;
+        }
+        m_ending = true;
+        _flush();
+        _maybe_finish();
+    }
+
+    // the socket of the connection, after the response headers
+    void do_start(async_file conn) {
+        if (conn.m_fd == -1) {
+            // the response headers could not be written
+            return _shutdown();
+        }
+        m_conn = std::move(conn);
+        _arm_heartbeat();
+        _start_output(m_conn);
+        _maybe_finish();
+        do_read();
+    }
+
+    void do_read() {
+        m_conn.async_read(
+            m_readbuf,
+            [self = shared_from_this()](expected<size_t> ret) {
+                if (self->m_closed) {
+                    return;
+                }
+                if (ret.error() || ret.value() == 0) {
+                    return self->_shutdown();
+                }
+                // nothing is expected from the client, dropped
+                self->do_read();
+            },
+            m_stop_read);
+    }
+
+    bool _check_full() {
+        if (m_buffered < m_high_water) {
+            return true;
+        }
+        m_full = true;
+        return false;
+    }
+
+    void _on_write_failed() {
+        _shutdown();
+    }
+
+    void _on_written() {
+        if (m_full && m_buffered < m_high_water && !m_ending) {
+            m_full = false;
+            // moved out for the call, which may close the stream
+            auto on_drain = std::move(m_on_drain);
+            if (on_drain) {
+                on_drain(multishot_call, *this);
+                if (!m_closed && !m_on_drain) {
+                    m_on_drain = std::move(on_drain);
+                }
+            }
+        }
+        _maybe_finish();
+    }
+
+    void _maybe_finish() {
+        if (m_ending && !m_closed && _output_idle()) {
+            _shutdown();
+        }
+    }
+
+    void _arm_heartbeat() {
+        m_stop_heartbeat = stop_source(std::in_place);
+        io_context::get().set_timeout(
+            m_heartbeat_interval,
+            [self = shared_from_this()] {
+                // also called when the timer is stopped
+                if (self->m_closed) {
+                    return;
+                }
+                if (self->m_writing &&
+                    self->m_bytes_written == self->m_heartbeat_written) {
+                    // the peer has not taken a byte for a whole interval
+                    return self->_shutdown();
+                }
+                if (!self->m_sent && !self->m_ending) {
+                    self->_queue({":\n", nullptr});
+                    self->_flush();
+                }
+                self->m_sent = false;
+                self->m_heartbeat_written = self->m_bytes_written;
+                self->_arm_heartbeat();
+            },
+            m_stop_heartbeat);
+    }
+
+    void _shutdown() {
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+        m_stop_read.request_stop();
+        m_stop_heartbeat.request_stop();
+        _stop_output();
+        m_conn = async_file{};
+        m_on_drain = nullptr;
+        auto on_close = std::move(m_on_close);
+        if (on_close) {
+            on_close(*this);
+        }
+    }
+};
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include "bytes_buffer.hpp"
+#include "callback.hpp"
+#include "http_server.hpp"
+#include "io_context.hpp"
+#include "msgpack.hpp"
+#include "reflect.hpp"
+#include "thread_pool.hpp"
+
+// reflected request and response bodies, as json or msgpack: the format is
+// picked from Content-Type and Accept, so one handler serves both
+enum class body_format {
+    json,
+    msgpack,
+};
+
+inline std::string_view content_type_of(body_format format) noexcept {
+    return format == body_format::msgpack ? "application/msgpack"
+                                          : "application/json";
+}
+
+// application/msgpack, application/x-msgpack and application/vnd.msgpack
+inline bool _is_msgpack(std::string_view media_type) noexcept {
+    return media_type.find("msgpack") != media_type.npos;
+}
+
+inline body_format request_format(http_server::http_request const &request) {
+    return _is_msgpack(request.header("content-type")) ? body_format::msgpack
+                                                       : body_format::json;
+}
+
+// the first of the two named in Accept, or else the format of the request
+inline body_format response_format(http_server::http_request const &request) {
+    auto accept = request.header("accept");
+    auto msgpack = accept.find("msgpack");
+    auto json = accept.find("json");
+    if (msgpack != accept.npos && (json == accept.npos || msgpack < json)) {
+        return body_format::msgpack;
+    }
+    if (json != accept.npos) {
+        return body_format::json;
+    }
+    return request_format(request);
+}
+
+// string_view members point into the request, valid until the response
+template <class T>
+inline bool decode_body(http_server::http_request const &request, T &value,
+                        std::error_code &ec) {
+    if (request_format(request) == body_format::msgpack) {
+        return reflect::msgpack_decode(request.body, value, ec);
+    }
+    return reflect::json_decode(request.body, value, ec);
+}
+
+template <class T, class Buffer>
+inline void encode_body(body_format format, T const &value, Buffer &out) {
+    if (format == body_format::msgpack) {
+        reflect::msgpack_encode(value, out);
+    } else {
+        reflect::json_encode(value, out);
+    }
+}
+
+// encoded straight into the response buffer
+template <class T>
+inline void write_body_response(http_server::http_request &request, int status,
+                                T const &value) {
+    auto format = response_format(request);
+    request.write_response_with(
+        status, [&](bytes_buffer &body) { encode_body(format, value, body); },
+        content_type_of(format));
+}
+
+// arrays of this many elements and more are worth encoding on a thread pool
+inline constexpr size_t parallel_encode_min_size = 4096;
+
+template <class T, class Buffer>
+inline void encode_body_chunk(body_format format, T const &value, size_t index,
+                              size_t count, Buffer &out) {
+    if (format == body_format::msgpack) {
+        reflect::msgpack_encode_chunk(value, index, count, out);
+    } else {
+        reflect::json_encode_chunk(value, index, count, out);
+    }
+}
+
+template <class T>
+struct _async_encode_state {
+    std::shared_ptr<T const> m_value;
+    body_format m_format;
+    std::vector<std::string> m_chunks;
+    std::atomic<size_t> m_remaining;
+    io_context *m_ctx;
+    callback<std::vector<std::string>> m_done;
+};
+
+// encodes value, an array or an object ending with one, in chunks on the
+// pool, one per worker; done(chunks) runs on the calling reactor once they
+// are all encoded, joined in order they are the body
+template <class T>
+inline void async_encode_body(thread_pool &pool, body_format format,
+                              std::shared_ptr<T const> value,
+                              callback<std::vector<std::string>> done) {
+    size_t count = pool.size();
+    if constexpr (requires { value->size(); }) {
+        // a chunk is not worth a hand-off below a quarter of the threshold
+        count = std::clamp<size_t>(value->size() / (parallel_encode_min_size / 4),
+                                   1, count);
+    }
+    auto state = std::make_shared<_async_encode_state<T>>();
+    state->m_value = std::move(value);
+    state->m_format = format;
+    state->m_chunks.resize(count);
+    state->m_remaining.store(count, std::memory_order_relaxed);
+    state->m_ctx = &io_context::get();
+    state->m_done = std::move(done);
+    state->m_ctx->add_work();
+    for (size_t i = 0; i < count; i++) {
+        pool.submit([state, i] {
+            encode_body_chunk(state->m_format, *state->m_value, i,
+                              state->m_chunks.size(), state->m_chunks[i]);
+            if (state->m_remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            state->m_ctx->post([state] {
+                state->m_ctx->work_done();
+                // done is destroyed here, on its reactor
+                auto done = std::move(state->m_done);
+                done(std::move(state->m_chunks));
+            });
+        });
+    }
+}
+
+// like write_body_response, but for a large array or an object ending with
+// one: the reactor goes on with other connections while the pool encodes,
+// the response is written once the chunks are back, without joining them
+template <class T>
+inline void write_body_response_async(http_server::http_request &request,
+                                      int status, thread_pool &pool,
+                                      std::shared_ptr<T const> value) {
+    auto format = response_format(request);
+    async_encode_body(pool, format, std::move(value),
+                      [&request, status, format](std::vector<std::string> chunks) {
+                          request.write_response(status, std::move(chunks),
+                                                 content_type_of(format));
+                      });
+}
@@ -4,6 +4,11 @@
 #include <map>
 #include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
 #include "bytes_buffer.hpp"
 #include "enum_parser.hpp"
 
@@ -15,10 +20,11 @@ struct http11_request_parser {
     bool m_header_finished{};
 
     void reset_state() {
+        // clear() keeps the capacity for the next request
         m_header.clear();
-        std::string().swap(m_headline);
-        std::string().swap(m_body);
-        std::map<std::string, std::string>().swap(m_header_keys);
+        m_headline.clear();
+        m_body.clear();
+        m_header_keys.clear();
         m_header_finished = {};
     }
 
@@ -97,12 +103,20 @@ struct _http_base_parser {
     size_t m_content_length{};
     size_t body_accumulated_size{};
     bool m_body_finished{};
+    // bytes received past the end of the message: the start of the next
+    // pipelined one, fed back by reset_state()
+    std::string m_leftover;
 
     void reset_state() {
         m_header_parser.reset_state();
         m_content_length = {};
         body_accumulated_size = {};
         m_body_finished = {};
+        if (!m_leftover.empty()) {
+            std::string leftover = std::move(m_leftover);
+            m_leftover.clear();
+            push_chunk(bytes_const_view{leftover.data(), leftover.size()});
+        }
     }
 
     [[nodiscard]] bool header_finished() {
@@ -185,17 +199,28 @@ struct _http_base_parser {
                 body_accumulated_size = body().size();
                 m_content_length = _extract_content_length();
                 if (body_accumulated_size >= m_content_length) {
-                    m_body_finished = true;
+                    _finish_body();
                 }
             }
         } else {
             body().append(chunk);
             body_accumulated_size += chunk.size();
             if (body_accumulated_size >= m_content_length) {
-                m_body_finished = true;
+                _finish_body();
             }
         }
     }
+
+    void _finish_body() {
+        m_body_finished = true;
+        auto &b = body();
+        if (b.size() > m_content_length) {
+            //! cut the extra bytes out of the body
+            m_leftover.assign(b, m_content_length);
+            b.resize(m_content_length);
+            body_accumulated_size = m_content_length;
+        }
+    }
 };
 
 enum class http_method {
@@ -221,6 +246,196 @@ struct http_request_parser : _http_base_parser<HeaderParser> {
     }
 };
 
+// zero-copy parser: the method, url, version, headers and body are views
+// into the caller's read buffer, valid until that buffer is modified
+// push_chunk() takes the whole buffer read so far (from the first byte of
+// the request), offsets are kept internally so the buffer may be grown
+// (reallocated) between two calls
+struct http11_request_view_parser {
+    struct _span {
+        uint32_t m_pos = 0;
+        uint32_t m_len = 0;
+    };
+
+    struct _header {
+        _span m_key;
+        _span m_value;
+    };
+
+    char const *m_base = nullptr;
+    size_t m_size = 0;
+    // where the search for \r\n\r\n resumes
+    size_t m_scan = 0;
+    // including the \r\n\r\n, 0 until the header is finished
+    size_t m_header_len = 0;
+    size_t m_content_length = 0;
+    _span m_method;
+    _span m_url;
+    _span m_version;
+    // clear() keeps the capacity, no allocation for typical requests
+    std::vector<_header> m_headers;
+
+    void reset_state() {
+        m_base = nullptr;
+        m_size = 0;
+        m_scan = 0;
+        m_header_len = 0;
+        m_content_length = 0;
+        m_method = m_url = m_version = {};
+        m_headers.clear();
+    }
+
+    [[nodiscard]] bool header_finished() const {
+        return m_header_len != 0;
+    }
+
+    [[nodiscard]] bool request_finished() const {
+        return m_header_len != 0 && m_size >= request_size();
+    }
+
+    // size of the whole request (header + body), once the header finished
+    size_t request_size() const {
+        return m_header_len + m_content_length;
+    }
+
+    // including the \r\n\r\n, once the header finished
+    size_t header_size() const {
+        return m_header_len;
+    }
+
+    // as announced by the client, once the header finished
+    size_t content_length() const {
+        return m_content_length;
+    }
+
+    void push_chunk(bytes_const_view buffer) {
+        m_base = buffer.data();
+        m_size = buffer.size();
+        if (m_header_len) {
+            return;
+        }
+        std::string_view data = buffer;
+        size_t pos = data.find("\r\n\r\n", m_scan < 3 ? 0 : m_scan - 3, 4);
+        if (pos == std::string_view::npos) {
+            m_scan = m_size;
+            return;
+        }
+        m_header_len = pos + 4;
+        _extract_headers(data.substr(0, pos));
+    }
+
+    _span _make_span(std::string_view whole, std::string_view part) const {
+        return {static_cast<uint32_t>(part.data() - whole.data()),
+                static_cast<uint32_t>(part.size())};
+    }
+
+    static std::string_view _trim(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+            s.remove_prefix(1);
+        }
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+            s.remove_suffix(1);
+        }
+        return s;
+    }
+
+    void _extract_headers(std::string_view header) {
+        size_t eol = header.find("\r\n", 0, 2);
+        std::string_view line = header.substr(0, eol);
+        //! METHOD URL VERSION
+        size_t sp1 = line.find(' ');
+        size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+        if (sp2 != std::string_view::npos) {
+            m_method = _make_span(header, line.substr(0, sp1));
+            m_url = _make_span(header, line.substr(sp1 + 1, sp2 - sp1 - 1));
+            m_version = _make_span(header, line.substr(sp2 + 1));
+        }
+        while (eol != std::string_view::npos) {
+            //! skip \r\n
+            size_t pos = eol + 2;
+            eol = header.find("\r\n", pos, 2);
+            line = header.substr(pos, eol == std::string_view::npos ? eol : eol - pos);
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) {
+                continue;
+            }
+            //! key: value
+            _header h{_make_span(header, line.substr(0, colon)),
+                      _make_span(header, _trim(line.substr(colon + 1)))};
+            m_headers.push_back(h);
+        }
+        auto length = header_value("content-length");
+        if (!length.empty()) {
+            auto res = std::from_chars(length.data(), length.data() + length.size(),
+                                       m_content_length);
+            if (res.ec != std::errc()) {
+                m_content_length = 0;
+            }
+        }
+    }
+
+    std::string_view _view(_span span) const {
+        return {m_base + span.m_pos, span.m_len};
+    }
+
+    std::string_view method_name() const {
+        return _view(m_method);
+    }
+
+    http_method method() const {
+        return parse_enum<http_method>(method_name());
+    }
+
+    std::string_view url() const {
+        return _view(m_url);
+    }
+
+    std::string_view version() const {
+        return _view(m_version);
+    }
+
+    std::string_view body() const {
+        return {m_base + m_header_len, m_content_length};
+    }
+
+    size_t header_count() const {
+        return m_headers.size();
+    }
+
+    std::string_view header_key(size_t i) const {
+        return _view(m_headers[i].m_key);
+    }
+
+    std::string_view header_value(size_t i) const {
+        return _view(m_headers[i].m_value);
+    }
+
+    static bool _iequals(std::string_view a, std::string_view b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        auto lower = [](char c) {
+            return 'A' <= c && c <= 'Z' ? static_cast<char>(c ^ 'A' ^ 'a') : c;
+        };
+        for (size_t i = 0; i < a.size(); i++) {
+            if (lower(a[i]) != lower(b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // case-insensitive lookup, empty if there is no such header
+    std::string_view header_value(std::string_view key) const {
+        for (auto const &h: m_headers) {
+            if (_iequals(_view(h.m_key), key)) {
+                return _view(h.m_value);
+            }
+        }
+        return {};
+    }
+};
+
 template <class HeaderParser = http11_request_parser>
 struct http_response_parser : _http_base_parser<HeaderParser> {
     int status() {
@@ -264,12 +479,42 @@ struct http11_header_writer {
     }
 };
 
+// a range of an open file, sent with sendfile()
+struct http_file_chunk {
+    int m_fd = -1;
+    size_t m_offset = 0;
+    size_t m_size = 0;
+};
+
+// a body sent from its own storage instead of being copied after the
+// headers, it goes out right after buffer()[0, m_head_end)
+struct _http_body_segment {
+    size_t m_head_end;
+    std::string m_owned;
+    std::shared_ptr<std::string const> m_shared;
+    // for a file body, m_file_owner keeps the fd open until it is sent
+    http_file_chunk m_file;
+    std::shared_ptr<void const> m_file_owner;
+
+    std::string_view data() const noexcept {
+        if (m_shared) {
+            return *m_shared;
+        }
+        return m_owned;
+    }
+};
+
 template <class HeadWriter = http11_header_writer>
 struct _http_base_writer {
     HeadWriter m_header_writer;
+    std::vector<_http_body_segment> m_segments;
+
+    // smaller bodies are still copied, an iovec entry costs more than that
+    static constexpr size_t _copy_body_limit = 1024;
 
     void reset_state() {
         m_header_writer.reset_state();
+        m_segments.clear();
     }
 
     void _begin_header(std::string_view first, std::string_view second, std::string_view third) {
@@ -291,6 +536,49 @@ struct _http_base_writer {
     void _write_body(std::string_view body) {
         m_header_writer.buffer().append(body);
     }
+
+    void _write_body(std::string &&body) {
+        if (body.size() < _copy_body_limit) {
+            return _write_body(std::string_view{body});
+        }
+        m_segments.push_back({buffer().size(), std::move(body), nullptr, {}, nullptr});
+    }
+
+    void _write_body(std::shared_ptr<std::string const> body) {
+        if (body->size() < _copy_body_limit) {
+            return _write_body(std::string_view{*body});
+        }
+        m_segments.push_back({buffer().size(), {}, std::move(body), {}, nullptr});
+    }
+
+    void _write_body(http_file_chunk file, std::shared_ptr<void const> owner) {
+        if (file.m_size == 0) {
+            return;
+        }
+        m_segments.push_back({buffer().size(), {}, nullptr, file, std::move(owner)});
+    }
+
+    // calls f(std::string_view) on every piece of the output in memory and
+    // f(http_file_chunk) on every file body, in order
+    template <class F>
+    void for_each_chunk(F &&f) {
+        std::string_view head = buffer();
+        size_t pos = 0;
+        for (auto &segment: m_segments) {
+            if (segment.m_head_end != pos) {
+                f(head.substr(pos, segment.m_head_end - pos));
+                pos = segment.m_head_end;
+            }
+            if (segment.m_file.m_fd != -1) {
+                f(segment.m_file);
+            } else {
+                f(segment.data());
+            }
+        }
+        if (pos != head.size()) {
+            f(head.substr(pos));
+        }
+    }
 };
 
 template <class HeaderWriter = http11_header_writer>
@@ -300,9 +588,64 @@ struct http_request_writer : _http_base_writer<HeaderWriter> {
     }
 };
 
+// the reason phrase of a status code (rfc 9110 section 15), a peer ignores
+// it but a person reading the response does not
+constexpr std::string_view http_status_reason(int status) noexcept {
+    switch (status) {
+    case 100: return "Continue";
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 203: return "Non-Authoritative Information";
+    case 204: return "No Content";
+    case 205: return "Reset Content";
+    case 206: return "Partial Content";
+    case 300: return "Multiple Choices";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 402: return "Payment Required";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 406: return "Not Acceptable";
+    case 407: return "Proxy Authentication Required";
+    case 408: return "Request Timeout";
+    case 409: return "Conflict";
+    case 410: return "Gone";
+    case 411: return "Length Required";
+    case 412: return "Precondition Failed";
+    case 413: return "Content Too Large";
+    case 414: return "URI Too Long";
+    case 415: return "Unsupported Media Type";
+    case 416: return "Range Not Satisfiable";
+    case 417: return "Expectation Failed";
+    case 421: return "Misdirected Request";
+    case 422: return "Unprocessable Content";
+    case 426: return "Upgrade Required";
+    case 428: return "Precondition Required";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Unknown";
+    }
+}
+
 template <class HeaderWriter = http11_header_writer>
 struct http_response_writer : _http_base_writer<HeaderWriter> {
     void begin_header(int status) {
-        this->_begin_header("HTTP/1.1", std::to_string(status), "OK");
+        this->_begin_header("HTTP/1.1", std::to_string(status),
+                            http_status_reason(status));
     }
 };
\ No newline at end of file
@@ -1,12 +1,26 @@
 #pragma once
 
-#include <map>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <stdexcept>
 #include <memory>
+#include <new>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "block_pool.hpp"
 #include "expected.hpp"
 #include "io_context.hpp"
 #include "stop_source.hpp"
 #include "http_codec.hpp"
+#include "event_stream.hpp"
+#include "websocket.hpp"
 
 struct http_server : std::enable_shared_from_this<http_server> {
     using pointer = std::shared_ptr<http_server>;
@@ -16,65 +30,585 @@ struct http_server : std::enable_shared_from_this<http_server> {
     }
 
     struct http_request {
-        std::string url;
+        // views into the connection's read buffer, valid until the response
+        // is written (i.e. until the next request)
+        std::string_view url;
+        std::string_view path;  // the url without the query
+        std::string_view query; // after the '?', empty if none
         http_method method; // GET, POST, PUT, ...
-        std::string body;
+        std::string_view version;
+        std::string_view body;
+        // the :param and *wildcard captures of the matched route, by name
+        std::vector<std::pair<std::string_view, std::string_view>> params;
 
+        http11_request_view_parser const *m_parser = nullptr;
         http_response_writer<> *m_res_writer = nullptr;
         callback<> m_resume;
+        // extra headers of the response, keep their capacity between requests
+        std::vector<std::pair<std::string_view, std::string>> m_headers;
+        // set by write_upgrade_response() and write_stream_response(), the
+        // connection leaves http
+        callback<async_file, std::string> m_upgrade;
 
+        // empty if the route has no such parameter
+        std::string_view param(std::string_view name) const {
+            for (auto &[key, value]: params) {
+                if (key == name) {
+                    return value;
+                }
+            }
+            return {};
+        }
+
+        // case-insensitive, empty if the request has no such header
+        std::string_view header(std::string_view key) const {
+            return m_parser->header_value(key);
+        }
+
+        // a header of the response, written by the next write_*(); the key
+        // is not copied, e.g. a literal
+        void set_header(std::string_view key, std::string_view value) {
+            m_headers.emplace_back(key, value);
+        }
+
+        // the content is copied
         void write_response(
             int status, std::string_view content,
             std::string_view content_type = "text/plain;charset=utf-8") {
+            _write_head(status, content.size(), content_type);
+            m_res_writer->_write_body(content);
+            _resume();
+        }
+
+        // the content is moved into the response and sent from there
+        template <class Str, class = std::enable_if_t<
+                                 std::is_same_v<Str, std::string>>>
+        void write_response(
+            int status, Str &&content,
+            std::string_view content_type = "text/plain;charset=utf-8") {
+            _write_head(status, content.size(), content_type);
+            m_res_writer->_write_body(std::move(content));
+            _resume();
+        }
+
+        // the body is the chunks joined, each one is sent from its own storage
+        void write_response(
+            int status, std::vector<std::string> &&chunks,
+            std::string_view content_type = "text/plain;charset=utf-8") {
+            size_t content_length = 0;
+            for (auto &chunk: chunks) {
+                content_length += chunk.size();
+            }
+            _write_head(status, content_length, content_type);
+            for (auto &chunk: chunks) {
+                m_res_writer->_write_body(std::move(chunk));
+            }
+            _resume();
+        }
+
+        // the body is the parts one after the other: a string_view is
+        // copied, a shared string is sent from its own storage
+        template <class... Parts>
+        void write_response_parts(int status, std::string_view content_type,
+                                  Parts const &...parts) {
+            _write_head(status, (size_t(0) + ... + _part_size(parts)),
+                        content_type);
+            (_write_part(parts), ...);
+            _resume();
+        }
+
+        static size_t _part_size(std::string_view part) noexcept {
+            return part.size();
+        }
+
+        static size_t _part_size(
+            std::shared_ptr<std::string const> const &part) noexcept {
+            return part->size();
+        }
+
+        void _write_part(std::string_view part) {
+            m_res_writer->_write_body(part);
+        }
+
+        void _write_part(std::shared_ptr<std::string const> const &part) {
+            m_res_writer->_write_body(part);
+        }
+
+        // the content is shared, e.g. a cached file, and sent without copy
+        void write_response(
+            int status, std::shared_ptr<std::string const> content,
+            std::string_view content_type = "text/plain;charset=utf-8") {
+            _write_head(status, content->size(), content_type);
+            m_res_writer->_write_body(std::move(content));
+            _resume();
+        }
+
+        // the body is sent from the file with sendfile(), owner keeps the
+        // fd open until then
+        void write_file_response(
+            int status, http_file_chunk file, std::shared_ptr<void const> owner,
+            std::string_view content_type = "application/octet-stream") {
+            _write_head(status, file.m_size, content_type);
+            m_res_writer->_write_body(file, std::move(owner));
+            _resume();
+        }
+
+        // 101 Switching Protocols, after which the connection is no longer
+        // http: once the response is written, take gets the socket and the
+        // bytes already read past this request (no socket, m_fd == -1, if
+        // the connection failed first)
+        void write_upgrade_response(std::string_view protocol,
+                                    callback<async_file, std::string> take) {
+            m_res_writer->begin_header(101);
+            m_res_writer->_write_header("Upgrade", protocol);
+            m_res_writer->_write_header("Connection", "Upgrade");
+            for (auto &[key, value]: m_headers) {
+                m_res_writer->_write_header(key, value);
+            }
+            m_headers.clear();
+            m_res_writer->_end_header();
+            m_upgrade = std::move(take);
+            _resume();
+        }
+
+        // the headers of a response whose body is streamed until the
+        // connection is closed (e.g. text/event-stream), after which the
+        // connection is no longer handled here: once they are written, take
+        // gets the socket and the bytes already read past this request (no
+        // socket, as for write_upgrade_response(), if it failed first)
+        void write_stream_response(int status, std::string_view content_type,
+                                   callback<async_file, std::string> take) {
+            m_res_writer->begin_header(status);
+            m_res_writer->_write_header("Server", "co_http");
+            m_res_writer->_write_header("Content-type", content_type);
+            m_res_writer->_write_header("Cache-Control", "no-cache");
+            // no length: the body ends with the connection
+            m_res_writer->_write_header("Connection", "close");
+            for (auto &[key, value]: m_headers) {
+                m_res_writer->_write_header(key, value);
+            }
+            m_headers.clear();
+            m_res_writer->_end_header();
+            m_upgrade = std::move(take);
+            _resume();
+        }
+
+        // fill(buffer) appends the body straight to the response buffer,
+        // e.g. an encoder, the length is filled in once it is known
+        template <class F>
+        void write_response_with(
+            int status, F &&fill,
+            std::string_view content_type = "text/plain;charset=utf-8") {
+            // trailing spaces in a header value are ignored by the peer
+            static constexpr std::string_view placeholder = "                    ";
+            _write_head(status, placeholder, content_type);
+            auto &buffer = m_res_writer->buffer();
+            size_t body_begin = buffer.size();
+            std::forward<F>(fill)(buffer);
+            size_t length_at = body_begin - 4 - placeholder.size();
+            std::to_chars(buffer.data() + length_at,
+                          buffer.data() + length_at + placeholder.size(),
+                          buffer.size() - body_begin);
+            _resume();
+        }
+
+        // moved out before the call: resuming may go on to the next request
+        // of the connection, which sets m_resume again
+        void _resume() {
+            auto resume = std::move(m_resume);
+            resume();
+        }
+
+        void _write_head(int status, size_t content_length,
+                         std::string_view content_type) {
+            char length[20];
+            auto end = std::to_chars(length, length + sizeof(length),
+                                     content_length).ptr;
+            _write_head(status, std::string_view(length, end - length),
+                        content_type);
+        }
+
+        void _write_head(int status, std::string_view content_length,
+                         std::string_view content_type) {
             m_res_writer->begin_header(status);
             m_res_writer->_write_header("Server", "co_http");
             m_res_writer->_write_header("Content-type", content_type);
             m_res_writer->_write_header("Connection", "keep-alive");
-            m_res_writer->_write_header("Content-length",
-                                       std::to_string(content.size()));
+            for (auto &[key, value]: m_headers) {
+                m_res_writer->_write_header(key, value);
+            }
+            m_headers.clear();
+            // last, write_response_with() fills it in before the blank line
+            m_res_writer->_write_header("Content-length", content_length);
             m_res_writer->_end_header();
-            m_res_writer->_write_body(content);
-            m_resume();
         }
     };
 
+    // compressed radix tree over the url path, a segment starting with
+    // ':' captures one path segment, one starting with '*' captures the rest
+    // of the path, e.g. "/user/:id/posts" or "/static/*file"
+    // priority: static text, then :param, then *wildcard
     struct http_router {
-        std::map<std::string, callback<http_request &>> m_routes;
+        static constexpr size_t _method_count =
+            static_cast<size_t>(http_method::CONNECT) + 1;
+
+        struct _node {
+            // static text matched by this node, after its parent
+            std::string m_prefix;
+            // the first char of each static child, for a quick scan
+            std::string m_indices;
+            std::vector<std::unique_ptr<_node>> m_children;
+            std::unique_ptr<_node> m_param;
+            std::unique_ptr<_node> m_wildcard;
+            std::string m_param_name;
+            // handlers by http_method, m_any for the routes without method
+            std::array<callback<http_request &>, _method_count> m_handlers;
+            callback<http_request &> m_any;
+            bool m_terminal = false;
+        };
+
+        _node m_root;
+
+        // the handler for every method
+        void route(std::string_view url, callback<http_request &> cb) {
+            _insert(url)->m_any = std::move(cb);
+        }
+
+        void route(http_method method, std::string_view url,
+                   callback<http_request &> cb) {
+            auto index = static_cast<size_t>(method);
+            if (index >= _method_count) {
+                throw std::invalid_argument("route: bad http method");
+            }
+            _insert(url)->m_handlers[index] = std::move(cb);
+        }
 
-        void route(std::string url, callback<http_request &> cb) {
-            // set callback function for url
-            m_routes.insert_or_assign(url, std::move(cb));
+        // a websocket endpoint: the handshake of a GET asking for the upgrade
+        // is answered here, on_open gets the request and the websocket, which
+        // is started once the 101 response is written (frames sent before
+        // are queued); any other GET gets a 426
+        void route_websocket(std::string_view url,
+                             callback<http_request &, websocket::pointer> on_open) {
+            route(http_method::GET, url, [on_open = std::move(on_open)](
+                                             http_request &request) {
+                if (!_has_token(request.header("upgrade"), "websocket") ||
+                    !_has_token(request.header("connection"), "upgrade") ||
+                    request.header("sec-websocket-version") != "13") {
+                    request.set_header("Upgrade", "websocket");
+                    request.set_header("Sec-WebSocket-Version", "13");
+                    return request.write_response(426, "426 Upgrade Required");
+                }
+                auto key = request.header("sec-websocket-key");
+                if (key.size() != 24) {
+                    return request.write_response(400, "400 Bad Request");
+                }
+                auto ws = websocket::make();
+                request.set_header("Sec-WebSocket-Accept", websocket_accept_key(key));
+                on_open(multishot_call, request, ws);
+                request.write_upgrade_response(
+                    "websocket", [ws](async_file conn, std::string rest) {
+                        ws->do_start(std::move(conn), rest);
+                    });
+            });
+        }
+
+        // a server-sent events endpoint: on_open gets the request and the
+        // stream, which is started once the response headers are written
+        // (events sent before are queued)
+        void route_event_stream(std::string_view url,
+                                callback<http_request &, event_stream::pointer> on_open) {
+            route(http_method::GET, url, [on_open = std::move(on_open)](
+                                             http_request &request) {
+                auto stream = event_stream::make();
+                on_open(multishot_call, request, stream);
+                request.write_stream_response(
+                    200, "text/event-stream",
+                    [stream](async_file conn, std::string) {
+                        stream->do_start(std::move(conn));
+                    });
+            });
+        }
+
+        // a comma separated header value holds token, case-insensitive
+        static bool _has_token(std::string_view list, std::string_view token) {
+            while (!list.empty()) {
+                auto item = list.substr(0, list.find(','));
+                list.remove_prefix(std::min(item.size() + 1, list.size()));
+                while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+                    item.remove_prefix(1);
+                }
+                while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+                    item.remove_suffix(1);
+                }
+                if (http11_request_view_parser::_iequals(item, token)) {
+                    return true;
+                }
+            }
+            return false;
         }
 
         void do_handle(http_request &request) {
-            // find url matched 
-            auto it = m_routes.find(request.url);
-            if (it != m_routes.end()) {
-                return it->second(multishot_call, request);
+            request.params.clear();
+            _node *node = _match(&m_root, request.path, request.params);
+            if (!node) {
+                // cannot find url;
+                return request.write_response(404, "404 Not Found");
+            }
+            auto index = static_cast<size_t>(request.method);
+            if (index < _method_count && node->m_handlers[index]) {
+                return node->m_handlers[index](multishot_call, request);
+            }
+            if (node->m_any) {
+                return node->m_any(multishot_call, request);
+            }
+            request.set_header("Allow", _allowed_methods(*node));
+            return request.write_response(405, "405 Method Not Allowed");
+        }
+
+        // the Allow header of a 405: the methods with a handler on the node
+        static std::string _allowed_methods(_node const &node) {
+            std::string allow;
+            for (size_t i = 0; i < _method_count; ++i) {
+                if (node.m_handlers[i]) {
+                    if (!allow.empty()) {
+                        allow.append(", ");
+                    }
+                    allow.append(dump_enum(static_cast<http_method>(i)));
+                }
             }
-            // cannot find url;
-            return request.write_response(404, "404 Not Found");
+            return allow;
         }
+
+        // the lookup only makes views, request.params keeps its capacity
+        static _node *_match(_node *node, std::string_view path,
+                             std::vector<std::pair<std::string_view,
+                                                   std::string_view>> &params) {
+            if (path.empty() && node->m_terminal) {
+                return node;
+            }
+            auto i = path.empty() ? node->m_indices.npos
+                                  : node->m_indices.find(path.front());
+            if (i != node->m_indices.npos) {
+                _node *child = node->m_children[i].get();
+                if (path.substr(0, child->m_prefix.size()) == child->m_prefix) {
+                    if (auto found = _match(
+                            child, path.substr(child->m_prefix.size()), params)) {
+                        return found;
+                    }
+                }
+            }
+            if (node->m_param) {
+                auto segment = path.substr(0, path.find('/'));
+                if (!segment.empty()) {
+                    params.emplace_back(node->m_param->m_param_name, segment);
+                    if (auto found = _match(node->m_param.get(),
+                                            path.substr(segment.size()), params)) {
+                        return found;
+                    }
+                    params.pop_back();
+                }
+            }
+            if (node->m_wildcard) {
+                params.emplace_back(node->m_wildcard->m_param_name, path);
+                return node->m_wildcard.get();
+            }
+            return nullptr;
+        }
+
+        _node *_insert(std::string_view url) {
+            _node *node = &m_root;
+            while (!url.empty()) {
+                // the static text up to the next segment starting with
+                // ':' or '*' (a segment starts after a '/')
+                size_t pos = 0;
+                while (pos < url.size() &&
+                       !((url[pos] == ':' || url[pos] == '*') &&
+                         (pos == 0 || url[pos - 1] == '/'))) {
+                    ++pos;
+                }
+                if (pos != 0) {
+                    node = _insert_static(node, url.substr(0, pos));
+                    url.remove_prefix(pos);
+                    continue;
+                }
+                auto name_end = std::min(url.find('/'), url.size());
+                auto name = url.substr(1, name_end - 1);
+                if (url.front() == '*') {
+                    if (name_end != url.size()) {
+                        throw std::invalid_argument("route: *wildcard must be last");
+                    }
+                    node = _insert_dynamic(node->m_wildcard, name);
+                } else {
+                    node = _insert_dynamic(node->m_param, name);
+                }
+                url.remove_prefix(name_end);
+            }
+            node->m_terminal = true;
+            return node;
+        }
+
+        static _node *_insert_dynamic(std::unique_ptr<_node> &slot,
+                                      std::string_view name) {
+            if (!slot) {
+                slot = std::make_unique<_node>();
+                slot->m_param_name = name;
+            } else if (slot->m_param_name != name) {
+                throw std::invalid_argument("route: conflicting parameter name");
+            }
+            return slot.get();
+        }
+
+        static _node *_insert_static(_node *node, std::string_view text) {
+            while (!text.empty()) {
+                auto i = node->m_indices.find(text.front());
+                if (i == node->m_indices.npos) {
+                    auto child = std::make_unique<_node>();
+                    child->m_prefix = text;
+                    node->m_indices.push_back(text.front());
+                    node->m_children.push_back(std::move(child));
+                    return node->m_children.back().get();
+                }
+                auto &child = node->m_children[i];
+                size_t common = 0;
+                while (common < child->m_prefix.size() && common < text.size() &&
+                       child->m_prefix[common] == text[common]) {
+                    ++common;
+                }
+                if (common < child->m_prefix.size()) {
+                    // split the child at the end of the common prefix
+                    auto mid = std::make_unique<_node>();
+                    mid->m_prefix = child->m_prefix.substr(0, common);
+                    child->m_prefix.erase(0, common);
+                    mid->m_indices.push_back(child->m_prefix.front());
+                    mid->m_children.push_back(std::move(child));
+                    child = std::move(mid);
+                }
+                node = child.get();
+                text.remove_prefix(common);
+            }
+            return node;
+        }
+    };
+
+    // a request over a limit is answered with 431 (header) or 413 (body)
+    // and its connection closed, before its bytes are read
+    struct http_limits {
+        size_t m_max_header_size = 16 * 1024;
+        size_t m_max_body_size = 16 * 1024 * 1024;
     };
 
     struct http_connection_handler
         : std::enable_shared_from_this<http_connection_handler> {
         async_file m_conn;
         bytes_buffer m_readbuf{1024};
-        http_request_parser<> m_req_parser;
+        // bytes of m_readbuf filled, m_readbuf[m_consumed, m_read_size) holds
+        // the request being parsed (and maybe more pipelined ones)
+        size_t m_read_size = 0;
+        size_t m_consumed = 0;
+        // set while the router runs, to tell a synchronous response apart
+        // from one resumed later
+        bool m_in_handler = false;
+        bool m_responded = false;
+        // the connection is closed once the response is written
+        bool m_closing = false;
+        http11_request_view_parser m_req_parser;
         http_response_writer<> m_res_writer;
+        // the pending output, m_iov[m_iov_done..] is left to write, an
+        // entry with a null iov_base stands for the next of m_files
+        std::vector<struct iovec> m_iov;
+        std::vector<http_file_chunk> m_files;
+        size_t m_iov_done = 0;
+        size_t m_file_done = 0;
         http_router *m_router = nullptr;
+        http_limits const *m_limits = nullptr;
         http_request m_request;
 
         using pointer = std::shared_ptr<http_connection_handler>;
 
+        // per reactor free list of handlers, their buffers keep their
+        // capacity while pooled
+        struct _pool {
+            std::vector<std::unique_ptr<http_connection_handler>> m_free;
+            size_t m_limit = 1024;
+        };
+
+        static _pool &_get_pool() {
+            static thread_local _pool pool;
+            return pool;
+        }
+
+        struct _recycle {
+            void operator()(http_connection_handler *conn) const {
+                conn->_drop_upgrade();
+                auto &pool = _get_pool();
+                if (pool.m_free.size() >= pool.m_limit) {
+                    delete conn;
+                    return;
+                }
+                conn->_reset_for_reuse();
+                pool.m_free.emplace_back(conn);
+            }
+        };
+
         static pointer make() {
-            return std::make_shared<pointer::element_type>();
+            auto &pool = _get_pool();
+            http_connection_handler *conn;
+            if (!pool.m_free.empty()) {
+                conn = pool.m_free.back().release();
+                pool.m_free.pop_back();
+            } else {
+                conn = new http_connection_handler;
+            }
+            return pointer(conn, _recycle{},
+                           block_pool_allocator<http_connection_handler>{});
+        }
+
+        void _reset_for_reuse() {
+            // closes the socket
+            m_conn = async_file{};
+            m_read_size = 0;
+            m_consumed = 0;
+            m_in_handler = false;
+            m_responded = false;
+            m_closing = false;
+            m_req_parser.reset_state();
+            m_res_writer.reset_state();
+            m_iov.clear();
+            m_files.clear();
+            m_iov_done = 0;
+            m_file_done = 0;
+            m_router = nullptr;
+            m_limits = nullptr;
+            m_request.url = {};
+            m_request.path = {};
+            m_request.query = {};
+            m_request.params.clear();
+            m_request.version = {};
+            m_request.body = {};
+            m_request.m_parser = nullptr;
+            m_request.m_res_writer = nullptr;
+            m_request.m_resume = nullptr;
+            m_request.m_headers.clear();
+            m_request.m_upgrade = nullptr;
         }
 
-        void do_start(http_router *router, int connfd) {
+        // an upgrade whose response could not be written still gets its
+        // take, without a socket: whatever was opened for it is closed
+        void _drop_upgrade() {
+            if (auto take = std::move(m_request.m_upgrade)) {
+                take(async_file{}, std::string());
+            }
+        }
+
+        void do_start(http_router *router, http_limits const *limits,
+                      int connfd) {
             m_router = router;
+            m_limits = limits;
             m_conn = async_file{connfd};
+            // a file body goes out in its own sendfile() after the headers,
+            // Nagle would hold it back until the headers are acked
+            int on = 1;
+            setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
             return do_read();
         }
 
@@ -83,6 +617,17 @@ struct http_server : std::enable_shared_from_this<http_server> {
             // set a 3s timer
             // if in 3s period haven't recieved any request
             // then client has given up, close the connection 
+            // the request is accumulated in m_readbuf, so that the parser
+            // can hand out views into it; grow it when it is full, as the
+            // bytes arrive and not to the Content-Length announced
+            if (m_read_size == m_readbuf.size()) {
+                try {
+                    m_readbuf.resize(m_readbuf.size() * 2);
+                } catch (std::bad_alloc const &) {
+                    // give up this connection only, not the reactor
+                    return;
+                }
+            }
             stop_source stop_io(std::in_place);
             stop_source stop_timer(std::in_place);
             io_context::get().set_timeout(
@@ -94,7 +639,7 @@ struct http_server : std::enable_shared_from_this<http_server> {
                 stop_timer);
             // start reading
             return m_conn.async_read(
-                m_readbuf,
+                m_readbuf.subspan(m_read_size, m_readbuf.size() - m_read_size),
                 [self = shared_from_this(),
                  stop_timer](expected<size_t> ret) {
                     // when finished reading, stop the timer
@@ -109,8 +654,12 @@ struct http_server : std::enable_shared_from_this<http_server> {
                         return;
                     }
                     // read successfully, push it into parsing
-                    self->m_req_parser.push_chunk(
-                        self->m_readbuf.subspan(0, n));
+                    self->m_read_size += n;
+                    self->m_req_parser.push_chunk(self->m_readbuf.subspan(
+                        self->m_consumed, self->m_read_size - self->m_consumed));
+                    if (int status = self->_check_limits()) {
+                        return self->do_reject(status);
+                    }
                     if (!self->m_req_parser.request_finished()) {
                         return self->do_read();
                     } else {
@@ -120,44 +669,199 @@ struct http_server : std::enable_shared_from_this<http_server> {
                 stop_io);
         }
 
+        // the status to reject the request being read with, 0 if it is within
+        // the limits
+        int _check_limits() const {
+            if (!m_req_parser.header_finished()) {
+                return m_read_size - m_consumed > m_limits->m_max_header_size
+                           ? 431
+                           : 0;
+            }
+            if (m_req_parser.header_size() > m_limits->m_max_header_size) {
+                return 431;
+            }
+            if (m_req_parser.content_length() > m_limits->m_max_body_size) {
+                return 413;
+            }
+            return 0;
+        }
+
+        // answers without reading the rest of the request, then closes
+        void do_reject(int status) {
+            m_res_writer.begin_header(status);
+            m_res_writer._write_header("Server", "co_http");
+            m_res_writer._write_header("Connection", "close");
+            m_res_writer._write_header("Content-length", "0");
+            m_res_writer._end_header();
+            m_closing = true;
+            return do_write();
+        }
+
         void do_handle() {
-            m_request.url = m_req_parser.url();
-            m_request.method = m_req_parser.method();
-            m_request.body = std::move(m_req_parser.body());
-            m_request.m_res_writer = &m_res_writer;
-            m_request.m_resume = [self = shared_from_this()] {
-                self->do_write(self->m_res_writer.buffer());
-            };
+            // handle every complete request already in the buffer (HTTP/1.1
+            // pipelining), their responses are accumulated in m_res_writer
+            // and flushed with a single write
+            do {
+                m_request.url = m_req_parser.url();
+                auto qpos = m_request.url.find('?');
+                m_request.path = m_request.url.substr(0, qpos);
+                m_request.query = qpos == std::string_view::npos
+                                      ? std::string_view{}
+                                      : m_request.url.substr(qpos + 1);
+                m_request.method = m_req_parser.method();
+                m_request.version = m_req_parser.version();
+                m_request.body = m_req_parser.body();
+                m_request.m_parser = &m_req_parser;
+                m_request.m_res_writer = &m_res_writer;
+                m_request.m_resume = [self = shared_from_this()] {
+                    self->on_response();
+                };
+                m_in_handler = true;
+                m_responded = false;
+                m_router->do_handle(m_request);
+                m_in_handler = false;
+                if (!m_responded) {
+                    // the handler will call m_resume later
+                    return;
+                }
+            } while (next_request());
+            do_write();
+        }
+
+        void on_response() {
+            if (m_in_handler) {
+                m_responded = true;
+                return;
+            }
+            if (next_request()) {
+                return do_handle();
+            }
+            return do_write();
+        }
+
+        // moves the parser to the bytes following the current request,
+        // returns true if they already hold a complete request (never after
+        // an upgrade, the bytes that follow are the new protocol's)
+        bool next_request() {
+            m_consumed += m_req_parser.request_size();
             m_req_parser.reset_state();
-            m_router->do_handle(m_request);
+            if (m_consumed == m_read_size || m_request.m_upgrade) {
+                return false;
+            }
+            m_req_parser.push_chunk(m_readbuf.subspan(
+                m_consumed, m_read_size - m_consumed));
+            return m_req_parser.request_finished();
         }
 
-        void do_write(bytes_const_view buffer) {
-            return m_conn.async_write(buffer, [self = shared_from_this(),
-                                               buffer](expected<size_t> ret) {
-                if (ret.error()) {
-                    // if write error, then give up connection
+        void do_write() {
+            // headers and bodies go out in one writev, bodies are not copied,
+            // file bodies are sent with sendfile() in between
+            m_iov.clear();
+            m_files.clear();
+            m_iov_done = 0;
+            m_file_done = 0;
+            m_res_writer.for_each_chunk([this](auto chunk) {
+                if constexpr (std::is_same_v<decltype(chunk), http_file_chunk>) {
+                    m_iov.push_back({nullptr, chunk.m_size});
+                    m_files.push_back(chunk);
+                } else {
+                    m_iov.push_back({const_cast<char *>(chunk.data()), chunk.size()});
+                }
+            });
+            return do_writev();
+        }
+
+        void do_writev() {
+            auto on_written = [self = shared_from_this()](expected<size_t> ret) {
+                if (ret.error() || ret.value() == 0) {
+                    // if write error, then give up connection (nothing
+                    // written: the file shrank below the announced size)
+                    return;
+                }
+                if (!self->_consume_iov(ret.value())) {
+                    return self->do_writev();
+                }
+                if (self->m_closing) {
+                    // the handler is released, which closes the socket
                     return;
                 }
-                auto n = ret.value();
+                if (self->m_request.m_upgrade) {
+                    auto take = std::move(self->m_request.m_upgrade);
+                    std::string rest(self->m_readbuf.begin() + self->m_consumed,
+                                     self->m_readbuf.begin() + self->m_read_size);
+                    return take(std::move(self->m_conn), std::move(rest));
+                }
+                // the views of the handled requests are dropped from
+                // here, move the partial next request to the front
+                self->m_res_writer.reset_state();
+                auto &readbuf = self->m_readbuf;
+                std::copy(readbuf.begin() + self->m_consumed,
+                          readbuf.begin() + self->m_read_size,
+                          readbuf.begin());
+                self->m_read_size -= self->m_consumed;
+                self->m_consumed = 0;
+                return self->do_read();
+            };
+            if (m_iov[m_iov_done].iov_base == nullptr) {
+                auto &file = m_files[m_file_done];
+                return m_conn.async_sendfile(file.m_fd, file.m_offset,
+                                             m_iov[m_iov_done].iov_len,
+                                             std::move(on_written));
+            }
+            // the memory entries up to the next file
+            size_t end = m_iov_done + 1;
+            while (end != m_iov.size() && m_iov[end].iov_base != nullptr) {
+                ++end;
+            }
+            return m_conn.async_writev(m_iov.data() + m_iov_done,
+                                       end - m_iov_done, std::move(on_written));
+        }
 
-                if (buffer.size() == n) {
-                    self->m_res_writer.reset_state();
-                    return self->do_read();
+        // skips n written bytes, returns true once everything is written;
+        // a sendfile() only writes the file entry it was given
+        bool _consume_iov(size_t n) {
+            size_t entry = m_iov_done;
+            bool is_file = m_iov[entry].iov_base == nullptr;
+            bool done = async_file::consume_iov(m_iov, m_iov_done, n);
+            if (is_file) {
+                if (m_iov_done != entry) {
+                    ++m_file_done;
+                } else {
+                    m_files[m_file_done].m_offset += n;
                 }
-                return self->do_write(buffer.subspan(n));
-            });
+            }
+            return done;
         }
     };
 
     async_file m_listening;
     address_resolver::address m_addr;
     http_router m_router;
+    http_limits m_limits;
 
     http_router &get_router() {
         return m_router;
     }
 
+    // the largest request header, request line included
+    void set_max_header_size(size_t n) {
+        m_limits.m_max_header_size = n;
+    }
+
+    // the largest request body (Content-Length)
+    void set_max_body_size(size_t n) {
+        m_limits.m_max_body_size = n;
+    }
+
+    // the number of idle connection handlers kept by the calling reactor
+    void set_connection_pool_limit(size_t limit) {
+        auto &pool = http_connection_handler::_get_pool();
+        pool.m_limit = limit;
+        if (pool.m_free.size() > limit) {
+            pool.m_free.resize(limit);
+        }
+    }
+
     void do_start(std::string name, std::string port) {
         address_resolver resolver;
         auto entry = resolver.resolve(name, port);
@@ -170,7 +874,8 @@ struct http_server : std::enable_shared_from_this<http_server> {
                                                     expected<int> ret) {
             auto connfd = ret.expect("accept");
             // std::cerr << "accept a connection from id: " << connfd << '\n';
-            http_connection_handler::make()->do_start(&self->m_router, connfd);
+            http_connection_handler::make()->do_start(
+                &self->m_router, &self->m_limits, connfd);
             return self->do_accept();
         });
     }
@@ -3,31 +3,149 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <system_error>
 #include <cassert>
+#include <algorithm>
 #include <array>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
 #include "timer_context.hpp"
 #include "bytes_buffer.hpp"
 #include "expected.hpp"
+#if USE_IO_URING
+#include <poll.h>
+#include "io_uring.hpp"
+#endif
 
 struct io_context : timer_context {
+#if USE_IO_URING
+    io_uring_ring m_ring{256};
+    // operations submitted to the ring whose completion is still pending
+    size_t m_uring_count = 0;
+    uint64_t m_uring_generation = 0;
+
+    // user_data = callback address | generation << 48, the generation makes
+    // a late cancel unable to hit a newer operation reusing the address
+    static constexpr uint64_t _uring_address_mask = (uint64_t(1) << 48) - 1;
+
+    // user_data of the read on m_post_fd, no callback address is that low
+    static constexpr uint64_t _uring_post_tag = 1;
+    uint64_t m_post_value = 0;
+#else
     int m_epfd;
     size_t m_epcount = 0;
+    // operations stopped while the current batch of events is handled: an
+    // event of the batch may still carry their (freed) callback address,
+    // e.g. the write side of a socket dup()ed for reads and writes
+    std::vector<void *> m_stopped;
+#endif
+
+    // callbacks posted by other threads, m_post_fd wakes the loop up
+    int m_post_fd;
+    std::mutex m_post_lock;
+    std::vector<callback<>> m_posted;
+    std::vector<callback<>> m_running;
+    // work handed to other threads that will post() back
+    size_t m_work_count = 0;
+    // stop() was called, join() returns with operations still pending
+    bool m_stop = false;
 
     static inline thread_local io_context *g_instance = nullptr;
 
+#if USE_IO_URING
+    io_context()
+        : m_post_fd(convert_error(eventfd(0, EFD_CLOEXEC)).expect("eventfd")) {
+        g_instance = this;
+        _uring_arm_post();
+    }
+#else
     io_context()
-        : m_epfd(convert_error(epoll_create1(0)).expect("epoll_create")) {
+        : m_epfd(convert_error(epoll_create1(0)).expect("epoll_create")),
+          m_post_fd(convert_error(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+                        .expect("eventfd")) {
         g_instance = this;        
+        // level triggered, and not counted in m_epcount: it does not keep
+        // join() running by itself
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = this;
+        convert_error(epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_post_fd, &event))
+            .expect("EPOLL_CTL_ADD");
+    }
+#endif
+
+    // thread safe: call runs on this reactor, from its loop
+    void post(callback<> call) {
+        bool was_empty;
+        {
+            std::lock_guard guard(m_post_lock);
+            was_empty = m_posted.empty();
+            m_posted.push_back(std::move(call));
+        }
+        // otherwise the loop has not taken the previous ones yet
+        if (was_empty) {
+            uint64_t one = 1;
+            (void)!write(m_post_fd, &one, sizeof(one));
+        }
+    }
+
+    // thread safe: join() returns once it has handled what is ready, even
+    // with operations still pending (e.g. another reactor failed)
+    void stop() {
+        post([this] { m_stop = true; });
+    }
+
+    // join() keeps running while work handed to another thread is pending:
+    // add_work() before handing it off, work_done() once it has been
+    // posted back
+    void add_work() noexcept {
+        ++m_work_count;
+    }
+
+    void work_done() noexcept {
+        --m_work_count;
+    }
+
+    void _run_posted() {
+        {
+            std::lock_guard guard(m_post_lock);
+            m_running.swap(m_posted);
+        }
+        for (auto &call: m_running) {
+            call();
+        }
+        m_running.clear();
     }
 
     void join() {
+#if USE_IO_URING
+        while (!is_empty() && !m_stop) {
+            std::chrono::nanoseconds dt = duration_to_next_timer();
+            struct timespec timeout, *timeoutp = nullptr;
+            if (dt.count() >= 0) {
+                timeout.tv_sec = dt.count() / 1000000000;
+                timeout.tv_nsec = dt.count() % 1000000000;
+                timeoutp = &timeout;
+            }
+            // a single io_uring_enter per iteration: submits every sqe
+            // queued since the last one, and waits for completions
+            m_ring.submit(1, timeoutp);
+            m_ring.for_each_cqe([this](struct io_uring_cqe const &cqe) {
+                _uring_dispatch(cqe);
+            });
+        }
+#else
         std::array<struct epoll_event, 128> events;
-        while (!is_empty()) {
+        while (!is_empty() && !m_stop) {
             std::chrono::nanoseconds dt = duration_to_next_timer();
 #if HAS_epoll_pwait2
             struct timespec timeout, *timeoutp = nullptr;
@@ -46,16 +164,91 @@ struct io_context : timer_context {
             int ret = convert_error(epoll_pwait(m_epfd, events.data(), events.size(),
                 timeout_ms, nullptr)).expect("epoll_pwait");
 #endif
+            m_stopped.clear();
             for (int i = 0; i < ret; i++) {
+                if (events[i].data.ptr == this) {
+                    uint64_t value;
+                    (void)!read(m_post_fd, &value, sizeof(value));
+                    _run_posted();
+                    continue;
+                }
+                if (!events[i].data.ptr) {
+                    // EPOLLHUP / EPOLLERR of an fd with no operation waiting
+                    continue;
+                }
+                if (std::find(m_stopped.begin(), m_stopped.end(),
+                              events[i].data.ptr) != m_stopped.end()) {
+                    continue;
+                }
                 auto call = callback<>::from_address(events[i].data.ptr);
                 call();
                 --m_epcount;
             }
         }
+#endif
+    }
+
+#if USE_IO_URING
+    uint64_t _uring_prepare(struct io_uring_sqe *sqe,
+                            callback<int, unsigned> &&call) {
+        auto addr = reinterpret_cast<uintptr_t>(call.leak_addresss());
+        uint64_t user_data = addr | (++m_uring_generation << 48);
+        sqe->user_data = user_data;
+        ++m_uring_count;
+        return user_data;
+    }
+
+    void _uring_cancel(uint64_t user_data) {
+        struct io_uring_sqe *sqe = m_ring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = user_data;
+        // the completion of the cancel itself is ignored
+        sqe->user_data = 0;
+    }
+
+    void _uring_arm_post() {
+        struct io_uring_sqe *sqe = m_ring.get_sqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = m_post_fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(&m_post_value);
+        sqe->len = sizeof(m_post_value);
+        sqe->off = static_cast<uint64_t>(-1);
+        sqe->user_data = _uring_post_tag;
+    }
+
+    void _uring_dispatch(struct io_uring_cqe const &cqe) {
+        if (cqe.user_data == 0) {
+            return;
+        }
+        if (cqe.user_data == _uring_post_tag) {
+            _uring_arm_post();
+            return _run_posted();
+        }
+        auto addr = reinterpret_cast<void *>(cqe.user_data & _uring_address_mask);
+        auto call = callback<int, unsigned>::from_address(addr);
+        if (cqe.flags & IORING_CQE_F_MORE) {
+            // multishot, the callback stays alive for the next completion
+            call(multishot_call, cqe.res, cqe.flags);
+            call.leak_addresss();
+        } else {
+            --m_uring_count;
+            call(cqe.res, cqe.flags);
+        }
     }
+#endif
 
     ~io_context() {
+        if (m_stop) {
+            // the callbacks of the pending timers are leaked, as the ones
+            // the kernel still holds are: they may use this io_context
+            for (auto &chunk: m_chunks) {
+                (void)chunk.release();
+            }
+        }
+#if !USE_IO_URING
         close(m_epfd);
+#endif
+        close(m_post_fd);
         g_instance = nullptr;
     }
 
@@ -65,7 +258,13 @@ struct io_context : timer_context {
     }
 
     bool is_empty() const {
-        return timer_context::is_empty() && m_epcount == 0;
+#if USE_IO_URING
+        return timer_context::is_empty() && m_uring_count == 0 &&
+               m_work_count == 0;
+#else
+        return timer_context::is_empty() && m_epcount == 0 &&
+               m_work_count == 0;
+#endif
     }
 };
 
@@ -169,8 +368,46 @@ struct address_resolver {
 };
 
 struct async_file : file_descriptor {
+#if USE_IO_URING
+    struct _uring_accept_state {
+        // accepted fds (or -errno) that no async_accept was waiting for
+        std::deque<int> m_ready;
+        callback<expected<int>> m_waiter;
+        stop_source m_waiter_stop;
+        // user_data of the armed accept, 0 if not armed
+        uint64_t m_user_data = 0;
+        bool m_multishot = true;
+
+        ~_uring_accept_state() {
+            for (int fd: m_ready) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+
+        void _deliver(int res) {
+            if (!m_waiter) {
+                m_ready.push_back(res);
+                return;
+            }
+            m_waiter_stop.clear_stop_callback();
+            m_waiter_stop = {};
+            auto call = std::move(m_waiter);
+            call(res);
+        }
+    };
+
+    std::shared_ptr<_uring_accept_state> m_accept;
+#endif
+
     async_file() = default;
 
+#if USE_IO_URING
+    // io_uring arms its own poll when a socket is not ready, so the fd is
+    // kept blocking (O_NONBLOCK would make older kernels return EAGAIN)
+    explicit async_file(int fd) : file_descriptor(fd) {}
+#else
     explicit async_file(int fd) : file_descriptor(fd) {
         int flag = convert_error(fcntl(m_fd, F_GETFL)).expect("F_GETFL");
         flag |= O_NONBLOCK;
@@ -183,23 +420,98 @@ struct async_file : file_descriptor {
             epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_ADD, m_fd, &event)
         ).expect("EPOLL_CTL_ADD");
     }
+#endif
+
+#if USE_IO_URING
+    template <class Prep>
+    void _uring_submit(Prep &&prep, callback<int, unsigned> call,
+                       stop_source stop) {
+        auto &ctx = io_context::get();
+        struct io_uring_sqe *sqe = ctx.m_ring.get_sqe();
+        prep(sqe);
+        uint64_t user_data = ctx._uring_prepare(sqe, std::move(call));
+        stop.set_stop_callback([user_data] {
+            io_context::get()._uring_cancel(user_data);
+        });
+    }
+
+    static void _uring_arm_accept(int fd,
+                                  std::shared_ptr<_uring_accept_state> state) {
+        auto &ctx = io_context::get();
+        struct io_uring_sqe *sqe = ctx.m_ring.get_sqe();
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        if (state->m_multishot) {
+            sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+        }
+        auto &user_data = state->m_user_data;
+        user_data = ctx._uring_prepare(sqe, [fd, state](int res, unsigned flags) {
+            if (!(flags & IORING_CQE_F_MORE)) {
+                state->m_user_data = 0;
+                if (res == -EINVAL && state->m_multishot) {
+                    // kernel older than 5.19, fall back to one-shot accepts
+                    state->m_multishot = false;
+                    return _uring_arm_accept(fd, state);
+                }
+                if (res == -ECANCELED && !state->m_waiter) {
+                    return;
+                }
+            }
+            state->_deliver(res);
+            if (!state->m_user_data && state->m_waiter) {
+                _uring_arm_accept(fd, state);
+            }
+        });
+    }
+#else
 
     void _epoll_callback(callback<> &&resume, uint32_t events, stop_source stop) {
+        // leak first: an inline callback moves to a stable address
+        void *resume_ptr = resume.leak_addresss();
         struct epoll_event event;
         event.events = events;
-        event.data.ptr = resume.get_address();
+        event.data.ptr = resume_ptr;
         convert_error(
             epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_MOD, m_fd, &event))
             .expect("EPOLL_CTL_MOD");
         ++io_context::get().m_epcount;
-        stop.set_stop_callback([resume_ptr = resume.leak_addresss()] {
+        stop.set_stop_callback([fd = m_fd, resume_ptr] {
+            // disarmed before the callback is freed, it only waits for
+            // EPOLLHUP / EPOLLERR then, which are skipped
+            auto &ctx = io_context::get();
+            struct epoll_event event;
+            event.events = 0;
+            event.data.ptr = nullptr;
+            (void)epoll_ctl(ctx.m_epfd, EPOLL_CTL_MOD, fd, &event);
+            ctx.m_stopped.push_back(resume_ptr);
+            --ctx.m_epcount;
             callback<>::from_address(resume_ptr)();
         });
     }
 
+#endif
+
     void async_read(bytes_view buf, callback<expected<size_t>> call,
                     stop_source stop = {}) {
-#if USE_LEVEL_TRIGGER
+#if USE_IO_URING
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        return _uring_submit(
+            [&](struct io_uring_sqe *sqe) {
+                sqe->opcode = IORING_OP_READ;
+                sqe->fd = m_fd;
+                sqe->addr = reinterpret_cast<uintptr_t>(buf.data());
+                sqe->len = buf.size();
+                sqe->off = static_cast<uint64_t>(-1);
+            },
+            [call = std::move(call), stop](int res, unsigned) mutable {
+                stop.clear_stop_callback();
+                return call(res);
+            },
+            stop);
+#elif USE_LEVEL_TRIGGER
         return _epoll_callback(
             [this, buf, call = std::move(call), stop]() mutable {
                 if (stop.stop_requested()) {
@@ -232,7 +544,25 @@ struct async_file : file_descriptor {
 
     void async_write(bytes_const_view buf, callback<expected<size_t>> call,
                      stop_source stop = {}) {
-#if USE_LEVEL_TRIGGER
+#if USE_IO_URING
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        return _uring_submit(
+            [&](struct io_uring_sqe *sqe) {
+                sqe->opcode = IORING_OP_WRITE;
+                sqe->fd = m_fd;
+                sqe->addr = reinterpret_cast<uintptr_t>(buf.data());
+                sqe->len = buf.size();
+                sqe->off = static_cast<uint64_t>(-1);
+            },
+            [call = std::move(call), stop](int res, unsigned) mutable {
+                stop.clear_stop_callback();
+                return call(res);
+            },
+            stop);
+#elif USE_LEVEL_TRIGGER
         return _epoll_callback(
             [this, buf, call = std::move(call), stop]() mutable {
                 if (stop.stop_requested()) {
@@ -240,6 +570,7 @@ struct async_file : file_descriptor {
                     return call(-ECANCELED);
                 }
                 auto res = convert_error<size_t>(write(m_fd, buf.data(), buf.size()));
+                stop.clear_stop_callback();
                 return call(res);
             },
             EPOLLOUT | EPOLLERR | EPOLLONESHOT, stop);
@@ -258,14 +589,196 @@ struct async_file : file_descriptor {
             [this, buf, call = std::move(call), stop]() mutable {
                 return async_write(buf, std::move(call), stop);
             },
-            EPOLLIN | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
+            EPOLLOUT | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
 #endif
     }
 
+    // skips n written bytes of iov from entry done on: done moves past the
+    // entries written whole, the one written in part is cut (an entry with a
+    // null iov_base, e.g. standing for a file, only gets shorter); returns
+    // true once every entry is written
+    static bool consume_iov(std::vector<struct iovec> &iov, size_t &done,
+                            size_t n) noexcept {
+        while (done != iov.size()) {
+            auto &entry = iov[done];
+            if (n < entry.iov_len) {
+                if (entry.iov_base) {
+                    entry.iov_base = static_cast<char *>(entry.iov_base) + n;
+                }
+                entry.iov_len -= n;
+                return false;
+            }
+            n -= entry.iov_len;
+            ++done;
+        }
+        return true;
+    }
+
+    // gather write, the iovec array must stay alive until call is invoked
+    // (may write less than the total, like write())
+    void async_writev(struct iovec const *iov, size_t iovcnt,
+                      callback<expected<size_t>> call, stop_source stop = {}) {
+#if USE_IO_URING
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        return _uring_submit(
+            [&](struct io_uring_sqe *sqe) {
+                sqe->opcode = IORING_OP_WRITEV;
+                sqe->fd = m_fd;
+                sqe->addr = reinterpret_cast<uintptr_t>(iov);
+                sqe->len = static_cast<unsigned>(iovcnt);
+                sqe->off = static_cast<uint64_t>(-1);
+            },
+            [call = std::move(call), stop](int res, unsigned) mutable {
+                stop.clear_stop_callback();
+                return call(res);
+            },
+            stop);
+#elif USE_LEVEL_TRIGGER
+        return _epoll_callback(
+            [this, iov, iovcnt, call = std::move(call), stop]() mutable {
+                if (stop.stop_requested()) {
+                    stop.clear_stop_callback();
+                    return call(-ECANCELED);
+                }
+                auto res = convert_error<size_t>(
+                    writev(m_fd, iov, static_cast<int>(iovcnt)));
+                stop.clear_stop_callback();
+                return call(res);
+            },
+            EPOLLOUT | EPOLLERR | EPOLLONESHOT, stop);
+#else
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        auto res = convert_error<size_t>(
+            writev(m_fd, iov, static_cast<int>(iovcnt)));
+        if (!res.is_error(EAGAIN)) {
+            stop.clear_stop_callback();
+            return call(res);
+        }
+
+        return _epoll_callback(
+            [this, iov, iovcnt, call = std::move(call), stop]() mutable {
+                return async_writev(iov, iovcnt, std::move(call), stop);
+            },
+            EPOLLOUT | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
+#endif
+    }
+
+    // sends count bytes of in_fd starting at offset, straight from the page
+    // cache (may send less than count, like write())
+    void async_sendfile(int in_fd, size_t offset, size_t count,
+                        callback<expected<size_t>> call, stop_source stop = {}) {
+#if USE_IO_URING
+        // io_uring has no sendfile opcode: try it without blocking, and
+        // wait for POLLOUT with a POLL_ADD when the socket is full
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        auto res = _sendfile_nonblock(in_fd, offset, count);
+        if (!res.is_error(EAGAIN)) {
+            stop.clear_stop_callback();
+            return call(res);
+        }
+        return _uring_submit(
+            [&](struct io_uring_sqe *sqe) {
+                sqe->opcode = IORING_OP_POLL_ADD;
+                sqe->fd = m_fd;
+                sqe->poll32_events = POLLOUT;
+            },
+            [this, in_fd, offset, count, call = std::move(call),
+             stop](int res, unsigned) mutable {
+                stop.clear_stop_callback();
+                if (res < 0) {
+                    return call(res);
+                }
+                return async_sendfile(in_fd, offset, count, std::move(call), stop);
+            },
+            stop);
+#elif USE_LEVEL_TRIGGER
+        return _epoll_callback(
+            [this, in_fd, offset, count, call = std::move(call), stop]() mutable {
+                if (stop.stop_requested()) {
+                    stop.clear_stop_callback();
+                    return call(-ECANCELED);
+                }
+                off_t off = static_cast<off_t>(offset);
+                auto res = convert_error<size_t>(sendfile(m_fd, in_fd, &off, count));
+                stop.clear_stop_callback();
+                return call(res);
+            },
+            EPOLLOUT | EPOLLERR | EPOLLONESHOT, stop);
+#else
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        off_t off = static_cast<off_t>(offset);
+        auto res = convert_error<size_t>(sendfile(m_fd, in_fd, &off, count));
+        if (!res.is_error(EAGAIN)) {
+            stop.clear_stop_callback();
+            return call(res);
+        }
+
+        return _epoll_callback(
+            [this, in_fd, offset, count, call = std::move(call), stop]() mutable {
+                return async_sendfile(in_fd, offset, count, std::move(call), stop);
+            },
+            EPOLLOUT | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
+#endif
+    }
+
+#if USE_IO_URING
+    // the fd is blocking in this mode, sendfile must not stall the reactor
+    expected<size_t> _sendfile_nonblock(int in_fd, size_t offset, size_t count) {
+        int flag = convert_error(fcntl(m_fd, F_GETFL)).expect("F_GETFL");
+        convert_error(fcntl(m_fd, F_SETFL, flag | O_NONBLOCK)).expect("F_SETFL");
+        off_t off = static_cast<off_t>(offset);
+        auto res = convert_error<size_t>(sendfile(m_fd, in_fd, &off, count));
+        convert_error(fcntl(m_fd, F_SETFL, flag)).expect("F_SETFL");
+        return res;
+    }
+#endif
+
     void async_accept(address_resolver::address &addr, 
                       callback<expected<int>> call,
                       stop_source stop = {}) {
-#if USE_LEVEL_TRIGGER
+#if USE_IO_URING
+        // a single multishot accept stays armed on the listening socket,
+        // the address is not filled in this mode
+        (void)addr;
+        if (stop.stop_requested()) {
+            stop.clear_stop_callback();
+            return call(-ECANCELED);
+        }
+        if (!m_accept) {
+            m_accept = std::make_shared<_uring_accept_state>();
+        }
+        auto state = m_accept;
+        if (!state->m_ready.empty()) {
+            int res = state->m_ready.front();
+            state->m_ready.pop_front();
+            stop.clear_stop_callback();
+            return call(res);
+        }
+        state->m_waiter = std::move(call);
+        state->m_waiter_stop = stop;
+        stop.set_stop_callback([state] {
+            state->m_waiter_stop = {};
+            auto call = std::move(state->m_waiter);
+            if (call) {
+                call(-ECANCELED);
+            }
+        });
+        if (!state->m_user_data) {
+            _uring_arm_accept(m_fd, state);
+        }
+#elif USE_LEVEL_TRIGGER
         return _epoll_callback(
             [this, &addr, call = std::move(call), stop]() mutable {
                 if (stop.stop_requested()) {
@@ -273,6 +786,7 @@ struct async_file : file_descriptor {
                     return call(-ECANCELED);
                 }
                 auto res = convert_error<int>(accept(m_fd, &addr.m_addr, &addr.m_addrlen));
+                stop.clear_stop_callback();
                 return call(res);
             },
             EPOLLIN | EPOLLERR | EPOLLONESHOT, stop);
@@ -302,6 +816,22 @@ struct async_file : file_descriptor {
             stop.clear_stop_callback();
             return call(-ECANCELED);
         }
+#if USE_IO_URING
+        // the address is read asynchronously, addr must outlive the call
+        return _uring_submit(
+            [&](struct io_uring_sqe *sqe) {
+                auto addr_ptr = addr.get_address();
+                sqe->opcode = IORING_OP_CONNECT;
+                sqe->fd = m_fd;
+                sqe->addr = reinterpret_cast<uintptr_t>(addr_ptr.m_addr);
+                sqe->off = addr_ptr.m_addrlen;
+            },
+            [call = std::move(call), stop](int res, unsigned) mutable {
+                stop.clear_stop_callback();
+                return call(res);
+            },
+            stop);
+#else
         auto addr_ptr = addr.get_address();
         auto res = convert_error(connect(m_fd, addr_ptr.m_addr, addr_ptr.m_addrlen));
         if (!res.is_error(EINPROGRESS)) {
@@ -327,6 +857,7 @@ struct async_file : file_descriptor {
                 return call(res);
             },
             EPOLLIN | EPOLLERR | EPOLLET | EPOLLONESHOT, stop);
+#endif
     }
 
     static async_file async_bind(address_resolver::address_info const &addr) {
@@ -345,9 +876,15 @@ struct async_file : file_descriptor {
     async_file &operator = (async_file &&) = default;
 
     ~async_file() {
+#if USE_IO_URING
+        if (m_accept && m_accept->m_user_data) {
+            io_context::get()._uring_cancel(m_accept->m_user_data);
+        }
+#else
         if (m_fd != -1) {
             epoll_ctl(io_context::get().m_epfd, EPOLL_CTL_DEL, m_fd, nullptr);
         }
+#endif
     }
 
     explicit operator bool() noexcept {
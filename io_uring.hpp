@@ -0,0 +1,181 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+#include "expected.hpp"
+
+// a minimal io_uring ring, talking to the kernel through the raw syscalls
+// (no liburing dependency)
+struct io_uring_ring {
+    int m_fd = -1;
+    unsigned m_features = 0;
+
+    void *m_sq_ptr = nullptr;
+    size_t m_sq_size = 0;
+    void *m_cq_ptr = nullptr;
+    size_t m_cq_size = 0;
+    struct io_uring_sqe *m_sqes = nullptr;
+    size_t m_sqes_size = 0;
+
+    unsigned *m_sq_head;
+    unsigned *m_sq_tail;
+    unsigned *m_sq_array;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    // sqes handed out but not yet seen by the kernel
+    unsigned m_sqe_tail = 0;
+    unsigned m_to_submit = 0;
+
+    unsigned *m_cq_head;
+    unsigned *m_cq_tail;
+    unsigned m_cq_mask;
+    struct io_uring_cqe *m_cqes;
+
+    explicit io_uring_ring(unsigned entries) {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_fd = convert_error<int>(static_cast<int>(
+            syscall(__NR_io_uring_setup, entries, &params))).expect("io_uring_setup");
+        m_features = params.features;
+        if (!(m_features & IORING_FEAT_EXT_ARG)) {
+            close(m_fd);
+            throw std::system_error(ENOSYS, std::system_category(),
+                                    "io_uring IORING_FEAT_EXT_ARG");
+        }
+
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        if (m_features & IORING_FEAT_SINGLE_MMAP) {
+            m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+        }
+        m_sq_ptr = _mmap(m_sq_size, IORING_OFF_SQ_RING);
+        if (m_features & IORING_FEAT_SINGLE_MMAP) {
+            m_cq_ptr = m_sq_ptr;
+        } else {
+            m_cq_ptr = _mmap(m_cq_size, IORING_OFF_CQ_RING);
+        }
+        m_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        m_sqes = static_cast<struct io_uring_sqe *>(_mmap(m_sqes_size, IORING_OFF_SQES));
+
+        auto sq = static_cast<char *>(m_sq_ptr);
+        m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        m_sq_entries = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+        m_sqe_tail = *m_sq_tail;
+
+        auto cq = static_cast<char *>(m_cq_ptr);
+        m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    void *_mmap(size_t size, off_t offset) {
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        if (ptr == MAP_FAILED) {
+            throw std::system_error(errno, std::system_category(), "io_uring mmap");
+        }
+        return ptr;
+    }
+
+    io_uring_ring(io_uring_ring &&) = delete;
+
+    ~io_uring_ring() {
+        if (m_sqes) {
+            munmap(m_sqes, m_sqes_size);
+        }
+        if (m_cq_ptr && m_cq_ptr != m_sq_ptr) {
+            munmap(m_cq_ptr, m_cq_size);
+        }
+        if (m_sq_ptr) {
+            munmap(m_sq_ptr, m_sq_size);
+        }
+        if (m_fd != -1) {
+            close(m_fd);
+        }
+    }
+
+    // returns a zeroed sqe, it is only handed to the kernel by the next
+    // submit(), so all the sqes prepared in one loop iteration go in one batch
+    struct io_uring_sqe *get_sqe() {
+        unsigned head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        if (m_sqe_tail - head >= m_sq_entries) {
+            // the submission queue is full, flush it without waiting
+            submit(0, nullptr);
+            head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+            if (m_sqe_tail - head >= m_sq_entries) {
+                throw std::system_error(EBUSY, std::system_category(),
+                                        "io_uring sq full");
+            }
+        }
+        unsigned index = m_sqe_tail & m_sq_mask;
+        struct io_uring_sqe *sqe = &m_sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        m_sq_array[index] = index;
+        ++m_sqe_tail;
+        ++m_to_submit;
+        return sqe;
+    }
+
+    // submit the pending sqes and wait for at least wait_nr completions,
+    // timeout == nullptr means wait forever
+    void submit(unsigned wait_nr, struct timespec const *timeout) {
+        __atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        std::memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if (timeout) {
+            ts.tv_sec = timeout->tv_sec;
+            ts.tv_nsec = timeout->tv_nsec;
+            arg.ts = reinterpret_cast<uintptr_t>(&ts);
+        }
+        unsigned flags = IORING_ENTER_EXT_ARG;
+        if (wait_nr) {
+            flags |= IORING_ENTER_GETEVENTS;
+        }
+        auto ret = convert_error<int>(static_cast<int>(
+            syscall(__NR_io_uring_enter, m_fd, m_to_submit, wait_nr, flags,
+                    &arg, sizeof(arg))));
+        if (ret.error()) {
+            if (ret.is_error(ETIME) || ret.is_error(EINTR) ||
+                ret.is_error(EBUSY) || ret.is_error(EAGAIN)) {
+                return;
+            }
+            ret.expect("io_uring_enter");
+        }
+        m_to_submit -= std::min<unsigned>(m_to_submit, ret.value());
+    }
+
+    bool has_pending_submit() const noexcept {
+        return m_to_submit != 0;
+    }
+
+    // pops every completion currently in the ring, calling f(cqe) on each
+    template <class F>
+    void for_each_cqe(F &&f) {
+        unsigned head = *m_cq_head;
+        for (;;) {
+            unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+            if (head == tail) {
+                break;
+            }
+            struct io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+            ++head;
+            // release the slot before the callback, which may submit more
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            f(cqe);
+        }
+    }
+};
@@ -1,8 +1,27 @@
 #include "io_context.hpp"
+#include "broadcast.hpp"
+#include "event_stream.hpp"
 #include "http_server.hpp"
+#include "http_body.hpp"
+#include "message_log.hpp"
+#include "message_store.hpp"
+#include "reactor_pool.hpp"
+#include "static_file.hpp"
+#include "thread_pool.hpp"
+#include "websocket.hpp"
 #include "file_utils.hpp"
 #include "reflect.hpp"
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
 #include <vector>
 
 struct Message {
@@ -12,34 +31,361 @@ struct Message {
     REFLECT(user, content);    
 };
 
-std::vector<Message> msg_list;
+// the body of /recv: the cursor of the client, the number of the first
+// message it does not have yet, and for how many seconds to wait for one
+// when there is none yet (a long-poll)
+struct RecvRequest {
+    std::optional<std::int64_t> first;
+    std::optional<double> wait;
 
-void server() {
-    io_context ctx;
-    auto server = http_server::make();
-    server->get_router().route("/", [](http_server::http_request &request) {
-        std::string response = file_get_content("index.html");
-        request.write_response(200, response, "text/html;charset=utf-8");
-    });
-    server->get_router().route("https://code.jquery.com/jquery-3.5.1.min.js", [](http_server::http_request &request) {
-        std::string response = file_get_content("https://code.jquery.com/jquery-3.5.1.min.js");
-        request.write_response(200, response, "text/javascript");
-    });
-    server->get_router().route("/send", [](http_server::http_request &request) {
-        msg_list.push_back(reflect::json_decode<Message>(request.body));
-        request.write_response(200, "msg get");
-    });
-    server->get_router().route("/recv", [](http_server::http_request &request) {
-        std::cout << "get a message\n";
-        request.write_response(200, reflect::json_encode(msg_list));
+    REFLECT(first, wait);
+};
+
+// a long-poll waits at most this many seconds
+constexpr double max_recv_wait = 60;
+
+// the reply of /recv: the messages from the cursor on, and the cursor of
+// the next poll
+struct RecvResponse {
+    std::uint64_t next = 0;
+    std::vector<std::shared_ptr<Message>> messages;
+
+    REFLECT(next, messages);
+};
+
+// the messages [first, next) as pushed to the clients, encoded once for all
+// of them
+struct ChatEvent {
+    std::uint64_t first = 0;
+    std::uint64_t next = 0;
+    // the json of the RecvResponse
+    std::string json;
+    // the same json, in a websocket text frame
+    std::string ws_frame;
+    // and in a server-sent event, its id is next
+    std::string sse;
+};
+
+using chat_broadcaster = broadcaster<ChatEvent>;
+
+// a slow websocket or event stream client is skipped over past this many
+// unsent bytes, it catches up from the store once it has drained (a
+// websocket with the next event)
+constexpr size_t push_backlog_limit = 1024 * 1024;
+constexpr backlog_policy push_backlog_policy = backlog_policy::drop;
+
+// the json of a RecvResponse, around the messages of a page
+std::string recv_json(message_store<Message>::json_page const &page) {
+    std::string json = "{\"next\":" + std::to_string(page.m_next) +
+                       ",\"messages\":";
+    json += *page.m_json;
+    json += '}';
+    return json;
+}
+
+// appends a message, and pushes it to the subscribers; returns its number
+std::uint64_t publish_message(message_store<Message> &store,
+                              chat_broadcaster &events, Message msg) {
+    auto number = store.append(std::move(msg));
+    // a subscriber catches up from the store when it subscribes, nobody
+    // misses the message if it is not published
+    if (!events.has_subscribers()) {
+        return number;
+    }
+    auto page = store.json_from(number);
+    auto event = std::make_shared<ChatEvent>();
+    event->first = page.m_first;
+    event->next = page.m_next;
+    event->json = recv_json(page);
+    event->ws_frame = websocket::make_frame(websocket::opcode::text, event->json);
+    event->sse = event_stream::make_event(event->json, {}, std::to_string(event->next));
+    events.publish(std::move(event));
+    return number;
+}
+
+// replies to a /recv with the messages from cursor on
+void write_recv_response(http_server::http_request &request,
+                         message_store<Message> &store, thread_pool &workers,
+                         std::uint64_t cursor) {
+    if (response_format(request) == body_format::json) {
+        // the json of a RecvResponse, around the messages cut out of
+        // the pre-encoded json and shared with the polls of the same page
+        auto page = store.json_from(cursor);
+        auto etag = '"' + std::to_string(page.m_next) + '"';
+        if (page.m_first == page.m_next &&
+            request.header("if-none-match") == etag) {
+            // nothing new since the last reply to this client
+            return request.write_response(304, "");
+        }
+        request.set_header("ETag", etag);
+        return request.write_response_parts(
+            200, content_type_of(body_format::json), "{\"next\":",
+            std::string_view(etag).substr(1, etag.size() - 2),
+            ",\"messages\":", page.m_json, "}");
+    }
+    auto slice = store.read_from(cursor);
+    RecvResponse response{slice.m_next, std::move(slice.m_messages)};
+    request.set_header("ETag", '"' + std::to_string(response.next) + '"');
+    // a large reply is encoded off the reactor
+    if (response.messages.size() < parallel_encode_min_size) {
+        return write_body_response(request, 200, response);
+    }
+    write_body_response_async(
+        request, 200, workers,
+        std::make_shared<RecvResponse const>(std::move(response)));
+}
+
+// a /ws or /events client, the messages are pushed to it over a websocket
+// or an event_stream; the cursor is the number of the first message it has
+// not been sent
+template <class Stream>
+struct PushClient {
+    typename Stream::pointer stream;
+    std::uint64_t cursor = 0;
+
+    // sends the messages from the cursor on
+    void catch_up(message_store<Message> &store) {
+        auto page = store.json_from(cursor);
+        if (page.m_first == page.m_next) {
+            return;
+        }
+        // moved first, a send may call back into it (on_drain)
+        cursor = page.m_next;
+        if constexpr (std::is_same_v<Stream, event_stream>) {
+            stream->send(recv_json(page), {}, std::to_string(page.m_next));
+        } else {
+            stream->send(recv_json(page));
+        }
+    }
+
+    // a batch of events, written at once
+    void push(chat_broadcaster::event_span events,
+              message_store<Message> &store) {
+        stream->cork();
+        for (auto const &event: events) {
+            if (event->next <= cursor) {
+                // sent already, by a catch up
+                continue;
+            }
+            if (stream->buffered_amount() > push_backlog_limit) {
+                if (push_backlog_policy == backlog_policy::disconnect) {
+                    _disconnect();
+                }
+                break;
+            }
+            if (event->first != cursor) {
+                // some events were skipped, or published out of order, the
+                // catch up sends the rest of the batch too
+                catch_up(store);
+                break;
+            }
+            cursor = event->next;
+            _send(event);
+        }
+        stream->uncork();
+    }
+
+    void _send(chat_broadcaster::event_pointer const &event) {
+        if constexpr (std::is_same_v<Stream, event_stream>) {
+            stream->send_event(std::shared_ptr<std::string const>(event, &event->sse));
+        } else {
+            stream->send_frame(std::shared_ptr<std::string const>(event, &event->ws_frame));
+        }
+    }
+
+    void _disconnect() {
+        if constexpr (std::is_same_v<Stream, event_stream>) {
+            stream->close();
+        } else {
+            stream->close(1008, "too slow");
+        }
+    }
+};
+
+// where a /ws?first=N or /events?first=N client starts, an event stream
+// that reconnects goes on from its Last-Event-ID
+std::uint64_t push_cursor(http_server::http_request &request) {
+    std::uint64_t cursor = 0;
+    auto last = request.header("last-event-id");
+    if (!last.empty()) {
+        std::from_chars(last.data(), last.data() + last.size(), cursor);
+    } else if (request.query.starts_with("first=")) {
+        std::from_chars(request.query.data() + 6,
+                        request.query.data() + request.query.size(), cursor);
+    }
+    return cursor;
+}
+
+void server(size_t reactors, bool pin_cpu, size_t retention,
+            std::string const &log_dir) {
+    // shared by all the reactors
+    message_store<Message> store(retention);
+    // with --log the messages outlive the process: the store is recovered
+    // from the log, and /send replies once its message is on disk
+    std::optional<message_log> log;
+    if (!log_dir.empty()) {
+        log.emplace(log_dir);
+        store.open_log(*log);
+    }
+    // large responses are encoded here, off the reactors
+    thread_pool workers;
+    // the long-polls and websockets waiting for messages, on every reactor
+    chat_broadcaster events;
+    reactor_pool pool;
+    pool.set_pin_cpu(pin_cpu);
+    pool.start(reactors, [&store, &log, &workers, &events](size_t) {
+        // every reactor owns its own listening socket and router
+        auto server = http_server::make();
+        // index.html is sent with sendfile(), its fd stays open per reactor
+        server->get_router().route(http_method::GET, "/", static_file_handler("."));
+        server->get_router().route("https://code.jquery.com/jquery-3.5.1.min.js", [](http_server::http_request &request) {
+            std::string response = file_get_content("https://code.jquery.com/jquery-3.5.1.min.js");
+            request.write_response(200, std::move(response), "text/javascript");
+        });
+        server->get_router().route(http_method::POST, "/send", [&store, &log, &events](http_server::http_request &request) {
+            // json or msgpack, by Content-Type
+            Message msg;
+            std::error_code ec;
+            if (!decode_body(request, msg, ec)) {
+                return request.write_response(400, ec.message());
+            }
+            if (!log) {
+                publish_message(store, events, std::move(msg));
+                return request.write_response(200, "msg get");
+            }
+            // the log cannot be written any more (e.g. the disk is full),
+            // the message would not be kept
+            if (auto ec = log->error()) {
+                return request.write_response(500, ec.message());
+            }
+            auto number = publish_message(store, events, std::move(msg));
+            // committed with the other messages of its batch
+            log->when_durable(number, [&request](std::error_code ec) {
+                if (ec) {
+                    return request.write_response(500, ec.message());
+                }
+                request.write_response(200, "msg get");
+            });
+        });
+        server->get_router().route("/recv", [&store, &workers, &events](http_server::http_request &request) {
+            std::cout << "get a message\n";
+            RecvRequest recv;
+            std::error_code ec;
+            if (request_format(request) == body_format::json) {
+                // only "first" and "wait" are parsed out of the body
+                auto body = reflect::jsonLazy(request.body);
+                body["first"].get(recv.first, ec);
+                body["wait"].get(recv.wait, ec);
+            } else {
+                decode_body(request, recv, ec);
+            }
+            auto cursor = static_cast<std::uint64_t>(
+                std::max<std::int64_t>(recv.first.value_or(0), 0));
+            double wait = std::min(recv.wait.value_or(0), max_recv_wait);
+            if (!(wait > 0) || store.head() > cursor) {
+                return write_recv_response(request, store, workers, cursor);
+            }
+            // parked until a message is published or the wait is over, the
+            // connection is resumed by the reply
+            auto stop = events.wait_for(
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>(wait)),
+                [&request, &store, &workers, cursor](chat_broadcaster::event_span events) {
+                    if (events.size() == 1 && events[0]->first == cursor &&
+                        response_format(request) == body_format::json) {
+                        // the json encoded once for every subscriber
+                        auto const &event = events[0];
+                        request.set_header("ETag", '"' + std::to_string(event->next) + '"');
+                        return request.write_response_parts(
+                            200, content_type_of(body_format::json),
+                            std::shared_ptr<std::string const>(event, &event->json));
+                    }
+                    // timed out, or several messages: a page from the store
+                    write_recv_response(request, store, workers, cursor);
+                });
+            // a message appended since the check may not be published to us
+            if (store.head() > cursor) {
+                stop.request_stop();
+            }
+        });
+        // ws://host/ws?first=N: the messages from N on are pushed as they
+        // come, and a message is sent as one frame, json in a text frame or
+        // msgpack in a binary one
+        server->get_router().route_websocket("/ws", [&store, &events](http_server::http_request &request, websocket::pointer ws) {
+            auto client = std::make_shared<PushClient<websocket>>(
+                PushClient<websocket>{ws, push_cursor(request)});
+            stop_source closed(std::in_place);
+            ws->on_close([closed](websocket &, std::uint16_t) {
+                closed.request_stop();
+            });
+            // subscribed first: what the catch up does not send is published
+            events.subscribe(
+                [client, &store](chat_broadcaster::event_span events) {
+                    client->push(events, store);
+                },
+                closed);
+            client->catch_up(store);
+            ws->on_message([&store, &events](websocket &ws, websocket::opcode op,
+                                             std::string_view data) {
+                Message msg;
+                std::error_code ec;
+                bool ok = op == websocket::opcode::text
+                              ? reflect::json_decode(data, msg, ec)
+                              : reflect::msgpack_decode(data, msg, ec);
+                if (!ok) {
+                    return ws.close(1007, ec.message());
+                }
+                publish_message(store, events, std::move(msg));
+            });
+        });
+        // server-sent events, for the browsers without websockets: the same
+        // pushes as /ws, a message is sent with a POST to /send
+        server->get_router().route_event_stream("/events", [&store, &events](http_server::http_request &request, event_stream::pointer stream) {
+            auto client = std::make_shared<PushClient<event_stream>>(
+                PushClient<event_stream>{stream, push_cursor(request)});
+            stop_source closed(std::in_place);
+            stream->on_close([closed](event_stream &) {
+                closed.request_stop();
+            });
+            // a client skipped over for its backlog catches up once it drains
+            stream->set_high_water_mark(push_backlog_limit);
+            stream->on_drain([client, &store](event_stream &) {
+                client->catch_up(store);
+            });
+            events.subscribe(
+                [client, &store](chat_broadcaster::event_span events) {
+                    client->push(events, store);
+                },
+                closed);
+            client->catch_up(store);
+        });
+        server->do_start("localhost", "8080");
     });
-    server->do_start("localhost", "8080");
-    ctx.join();
+    pool.join();
 }
 
-int main() {
+int main(int argc, char **argv) {
+    // usage: server [reactors] [--pin-cpu] [--retention messages] [--log dir]
+    size_t reactors = reactor_pool::default_concurrency();
+    bool pin_cpu = false;
+    size_t retention = 65536;
+    std::string log_dir;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--pin-cpu") == 0) {
+            pin_cpu = true;
+        } else if (std::strcmp(argv[i], "--retention") == 0 && i + 1 < argc) {
+            retention = std::max<size_t>(std::stoul(argv[++i]), 1);
+        } else if (std::strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            log_dir = argv[++i];
+        } else {
+            reactors = std::stoul(argv[i]);
+        }
+    }
+    // a write to a peer that is gone fails with EPIPE, instead of killing
+    // the process
+    std::signal(SIGPIPE, SIG_IGN);
     try {
-        server();
+        server(reactors, pin_cpu, retention, log_dir);
     } catch (std::system_error const &e)  {
         // std::cerr << e.what() << '\n';
     }
@@ -0,0 +1,502 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+#include "callback.hpp"
+#include "expected.hpp"
+#include "io_context.hpp"
+
+// slicing-by-8 tables of the crc-32c (castagnoli) polynomial, reflected
+inline constexpr auto _crc32c_tables = [] {
+    std::array<std::array<std::uint32_t, 256>, 8> tables{};
+    for (std::uint32_t i = 0; i < 256; i++) {
+        std::uint32_t crc = i;
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        tables[0][i] = crc;
+    }
+    for (std::uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+        }
+    }
+    return tables;
+}();
+
+// crc-32c (rfc 3720), crc is the crc of the bytes before data
+inline std::uint32_t crc32c(std::string_view data, std::uint32_t crc = 0) {
+    auto p = reinterpret_cast<unsigned char const *>(data.data());
+    size_t n = data.size();
+    crc = ~crc;
+#if defined(__SSE4_2__)
+    std::uint64_t crc64 = crc;
+    for (; n >= 8; p += 8, n -= 8) {
+        std::uint64_t word;
+        std::memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<std::uint32_t>(crc64);
+    for (; n != 0; p++, n--) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+#else
+    auto &t = _crc32c_tables;
+    for (; n >= 8; p += 8, n -= 8) {
+        std::uint32_t lo = crc ^ (std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8 |
+                                  std::uint32_t(p[2]) << 16 | std::uint32_t(p[3]) << 24);
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^
+              t[4][lo >> 24] ^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+    }
+    for (; n != 0; p++, n--) {
+        crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+    }
+#endif
+    return ~crc;
+}
+
+// a durable append-only log of records, numbered from 0, in segment files
+// dir/<number of their first record>.log; a record is its length and the
+// crc-32c of the length and the payload (both u32 little endian), then the
+// payload
+// group commit: appends only queue the record, a writer thread writes what
+// has queued with one write() and one fdatasync(), once the oldest queued
+// record has waited the commit interval or commit bytes have queued (with
+// no interval, at once: what queues during a sync is the next batch); the
+// segment is rolled between two batches once it is over the segment size
+// recovery mmaps the segments: the number of records of every segment but
+// the last comes from the file names, only the records wanted back (the
+// tail) and the last segment are read and checked, a torn write at the end
+// of the last one is cut off
+// a failed write or sync stops the writer: the records not on disk by then
+// never will be, their waiters and those of every later append get the error
+struct message_log {
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t _header_size = 8;
+
+    // run on its reactor once its record is on disk, or with the error
+    // that stopped the writer
+    struct _waiter {
+        io_context *m_ctx;
+        std::uint64_t m_number;
+        callback<std::error_code> m_call;
+    };
+
+    std::string m_dir;
+    size_t m_segment_size = 64 * 1024 * 1024;
+    clock::duration m_commit_interval{};
+    size_t m_commit_bytes = 1024 * 1024;
+
+    // only touched by the writer thread once it is started
+    file_descriptor m_dir_fd;
+    file_descriptor m_file;
+    size_t m_file_size = 0;
+    std::uint64_t m_written = 0;
+    std::string m_batch;
+
+    std::mutex m_lock;
+    std::condition_variable m_ready;
+    // the records queued since the last batch, the first one at
+    // m_pending_since
+    std::string m_pending;
+    clock::time_point m_pending_since;
+    // the number of the next record
+    std::uint64_t m_appended = 0;
+    // the records before it are on disk
+    std::uint64_t m_durable = 0;
+    std::vector<_waiter> m_waiters;
+    // set once the writer failed, nothing is written after
+    std::error_code m_error;
+    bool m_stop = false;
+    std::thread m_writer;
+
+    explicit message_log(std::string dir) : m_dir(std::move(dir)) {}
+
+    message_log(message_log &&) = delete;
+
+    // the settings are read by open()
+    void set_segment_size(size_t n) {
+        m_segment_size = n;
+    }
+
+    void set_commit_interval(clock::duration dt) {
+        m_commit_interval = dt;
+    }
+
+    void set_commit_bytes(size_t n) {
+        m_commit_bytes = n;
+    }
+
+    // recovers the log, creating the directory if it does not exist: calls
+    // on_record(number, payload) with each of the last tail records, in
+    // order (the payload is only valid during the call), then starts the
+    // writer; returns the number of records
+    template <class F>
+    std::uint64_t open(std::uint64_t tail, F &&on_record) {
+        if (mkdir(m_dir.c_str(), 0755) == -1 && errno != EEXIST) {
+            convert_error(-1).expect("mkdir");
+        }
+        m_dir_fd = file_descriptor{
+            convert_error(::open(m_dir.c_str(), O_RDONLY | O_DIRECTORY)).expect("open log dir")};
+        auto firsts = _list_segments();
+        if (firsts.empty()) {
+            _create_segment(0);
+        } else {
+            _recover(firsts, tail, on_record);
+        }
+        m_durable = m_appended;
+        m_writer = std::thread([this] { _run(); });
+        return m_appended;
+    }
+
+    // a record for append_record(), framed out of any lock
+    static std::string make_record(std::string_view payload) {
+        std::string record(_header_size + payload.size(), '\0');
+        auto length = static_cast<std::uint32_t>(payload.size());
+        _put_u32(record.data(), length);
+        std::uint32_t crc = crc32c(payload, crc32c(std::string_view(record.data(), 4)));
+        _put_u32(record.data() + 4, crc);
+        std::memcpy(record.data() + _header_size, payload.data(), payload.size());
+        return record;
+    }
+
+    // thread safe, returns the number of the record
+    std::uint64_t append_record(std::string_view record) {
+        bool wake;
+        std::uint64_t number;
+        {
+            std::lock_guard guard(m_lock);
+            if (m_error) {
+                // numbered all the same, when_durable() reports the error
+                return m_appended++;
+            }
+            if (m_pending.empty()) {
+                m_pending_since = clock::now();
+            }
+            m_pending.append(record);
+            number = m_appended++;
+            // the writer waits for the first record, then for the trigger
+            wake = m_pending.size() == record.size() ||
+                   m_pending.size() >= m_commit_bytes;
+        }
+        if (wake) {
+            m_ready.notify_one();
+        }
+        return number;
+    }
+
+    // call runs on this reactor once the record number is on disk, at once
+    // if it is already; with an error if it never will be
+    void when_durable(std::uint64_t number, callback<std::error_code> call) {
+        io_context *ctx = &io_context::get();
+        std::error_code ec;
+        {
+            std::lock_guard guard(m_lock);
+            if (number >= m_durable && !m_error) {
+                ctx->add_work();
+                m_waiters.push_back({ctx, number, std::move(call)});
+                return;
+            }
+            if (number >= m_durable) {
+                ec = m_error;
+            }
+        }
+        call(ec);
+    }
+
+    // thread safe, why the writer stopped, if it did
+    std::error_code error() {
+        std::lock_guard guard(m_lock);
+        return m_error;
+    }
+
+    // what is queued is written first; the waiters left are dropped, their
+    // reactors may be gone
+    ~message_log() {
+        {
+            std::lock_guard guard(m_lock);
+            m_stop = true;
+        }
+        m_ready.notify_one();
+        if (m_writer.joinable()) {
+            m_writer.join();
+        }
+    }
+
+    void _run() {
+        std::unique_lock guard(m_lock);
+        while (true) {
+            m_ready.wait(guard, [this] { return m_stop || !m_pending.empty(); });
+            if (m_pending.empty()) {
+                return;
+            }
+            m_ready.wait_until(guard, m_pending_since + m_commit_interval, [this] {
+                return m_stop || m_pending.size() >= m_commit_bytes;
+            });
+            m_batch.clear();
+            m_batch.swap(m_pending);
+            std::uint64_t end = m_appended;
+            guard.unlock();
+            std::error_code ec;
+            try {
+                _write_batch(end);
+            } catch (std::system_error const &e) {
+                // e.g. ENOSPC or EIO, not worth taking the server down
+                ec = e.code();
+            }
+            guard.lock();
+            if (ec) {
+                m_error = ec;
+                m_pending.clear();
+                end = std::numeric_limits<std::uint64_t>::max();
+            } else {
+                m_durable = end;
+            }
+            if (!m_stop) {
+                auto resumed = _take_waiters(end);
+                guard.unlock();
+                for (auto &[ctx, calls]: resumed) {
+                    ctx->post([ctx = ctx, calls = std::move(calls), ec]() mutable {
+                        for (auto &call: calls) {
+                            ctx->work_done();
+                            call(ec);
+                        }
+                    });
+                }
+                guard.lock();
+            }
+            if (ec) {
+                return;
+            }
+        }
+    }
+
+    using _resumed = std::vector<
+        std::pair<io_context *, std::vector<callback<std::error_code>>>>;
+
+    // under m_lock, the waiters of the records before end, by reactor
+    _resumed _take_waiters(std::uint64_t end) {
+        _resumed resumed;
+        auto it = std::stable_partition(
+            m_waiters.begin(), m_waiters.end(),
+            [end](_waiter const &waiter) { return waiter.m_number >= end; });
+        for (auto w = it; w != m_waiters.end(); ++w) {
+            auto group = std::find_if(resumed.begin(), resumed.end(), [&](auto &g) {
+                return g.first == w->m_ctx;
+            });
+            if (group == resumed.end()) {
+                resumed.emplace_back(w->m_ctx,
+                                     std::vector<callback<std::error_code>>());
+                group = std::prev(resumed.end());
+            }
+            group->second.push_back(std::move(w->m_call));
+        }
+        m_waiters.erase(it, m_waiters.end());
+        return resumed;
+    }
+
+    // the records [m_written, end) are in m_batch
+    void _write_batch(std::uint64_t end) {
+        if (m_file_size >= m_segment_size) {
+            _create_segment(m_written);
+        }
+        std::string_view data = m_batch;
+        while (!data.empty()) {
+            auto n = convert_error<size_t>(write(m_file.m_fd, data.data(), data.size()))
+                         .expect("write log");
+            data.remove_prefix(n);
+        }
+        convert_error(fdatasync(m_file.m_fd)).expect("fdatasync log");
+        m_file_size += m_batch.size();
+        m_written = end;
+    }
+
+    std::string _segment_path(std::uint64_t first) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%020llu.log",
+                      static_cast<unsigned long long>(first));
+        return m_dir + name;
+    }
+
+    // the new file is made durable with its directory entry
+    void _create_segment(std::uint64_t first) {
+        m_file = file_descriptor{convert_error(
+            ::open(_segment_path(first).c_str(),
+                   O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644))
+                                     .expect("create log segment")};
+        convert_error(fsync(m_dir_fd.m_fd)).expect("fsync log dir");
+        m_file_size = 0;
+    }
+
+    // the first record numbers of the segments, sorted
+    std::vector<std::uint64_t> _list_segments() {
+        std::vector<std::uint64_t> firsts;
+        DIR *dir = opendir(m_dir.c_str());
+        if (!dir) {
+            convert_error(-1).expect("opendir");
+        }
+        while (auto entry = readdir(dir)) {
+            std::string_view name = entry->d_name;
+            if (name.size() == 24 && name.ends_with(".log") &&
+                std::all_of(name.begin(), name.begin() + 20,
+                            [](char c) { return c >= '0' && c <= '9'; })) {
+                firsts.push_back(std::stoull(std::string(name.substr(0, 20))));
+            }
+        }
+        closedir(dir);
+        std::sort(firsts.begin(), firsts.end());
+        return firsts;
+    }
+
+    // a read-only mapping of a segment
+    struct _mapping {
+        file_descriptor m_file;
+        char const *m_data = nullptr;
+        size_t m_size = 0;
+
+        _mapping() = default;
+        _mapping(_mapping const &) = delete;
+
+        ~_mapping() {
+            if (m_data) {
+                munmap(const_cast<char *>(m_data), m_size);
+            }
+        }
+
+        std::string_view data() const noexcept {
+            return {m_data, m_size};
+        }
+    };
+
+    void _map(std::uint64_t first, int flags, _mapping &mapping) {
+        mapping.m_file = file_descriptor{convert_error(
+            ::open(_segment_path(first).c_str(), flags | O_CLOEXEC)).expect("open log segment")};
+        struct stat st;
+        convert_error(fstat(mapping.m_file.m_fd, &st)).expect("fstat log segment");
+        mapping.m_size = static_cast<size_t>(st.st_size);
+        if (mapping.m_size == 0) {
+            return;
+        }
+        void *ptr = mmap(nullptr, mapping.m_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                         mapping.m_file.m_fd, 0);
+        if (ptr == MAP_FAILED) {
+            convert_error(-1).expect("mmap log segment");
+        }
+        madvise(ptr, mapping.m_size, MADV_SEQUENTIAL);
+        mapping.m_data = static_cast<char const *>(ptr);
+    }
+
+    // calls f(payload) with every whole record whose crc matches, from the
+    // start of data; returns the bytes they take
+    template <class F>
+    static size_t _scan(std::string_view data, bool check, F &&f) {
+        size_t pos = 0;
+        while (data.size() - pos >= _header_size) {
+            std::uint32_t length = _get_u32(data.data() + pos);
+            if (length > data.size() - pos - _header_size) {
+                break;
+            }
+            std::string_view payload = data.substr(pos + _header_size, length);
+            if (check && _get_u32(data.data() + pos + 4) !=
+                             crc32c(payload, crc32c(data.substr(pos, 4)))) {
+                break;
+            }
+            f(payload);
+            pos += _header_size + length;
+        }
+        return pos;
+    }
+
+    template <class F>
+    void _recover(std::vector<std::uint64_t> const &firsts, std::uint64_t tail,
+                  F &on_record) {
+        // the last segment is checked to the end, it may hold a torn write
+        std::uint64_t last_first = firsts.back();
+        std::uint64_t last_count = 0;
+        _mapping last;
+        _map(last_first, O_RDONLY, last);
+        size_t valid = _scan(last.data(), true, [&](std::string_view) { ++last_count; });
+        m_appended = last_first + last_count;
+        std::uint64_t from = m_appended > tail ? m_appended - tail : 0;
+        // the other segments are whole, their number of records is the
+        // difference of the names
+        for (size_t i = 0; i + 1 < firsts.size(); i++) {
+            std::uint64_t first = firsts[i];
+            std::uint64_t count = firsts[i + 1] - first;
+            if (first + count <= from) {
+                continue;
+            }
+            _mapping mapping;
+            _map(first, O_RDONLY, mapping);
+            std::uint64_t number = first;
+            _scan(mapping.data(), true, [&](std::string_view payload) {
+                if (number >= from && number < first + count) {
+                    on_record(number, payload);
+                }
+                ++number;
+            });
+            if (number != first + count) {
+                throw std::runtime_error("message_log: segment " +
+                                         _segment_path(first) + " is corrupt");
+            }
+        }
+        std::uint64_t number = last_first;
+        _scan(last.data().substr(0, valid), false, [&](std::string_view payload) {
+            if (number >= from) {
+                on_record(number, payload);
+            }
+            ++number;
+        });
+        m_written = m_appended;
+        m_file = file_descriptor{convert_error(
+            ::open(_segment_path(last_first).c_str(), O_WRONLY | O_APPEND | O_CLOEXEC))
+                                     .expect("open log segment")};
+        struct stat st;
+        convert_error(fstat(m_file.m_fd, &st)).expect("fstat log segment");
+        if (static_cast<size_t>(st.st_size) != valid) {
+            // the appends go on after the last whole record
+            convert_error(ftruncate(m_file.m_fd, static_cast<off_t>(valid)))
+                .expect("truncate log segment");
+            convert_error(fdatasync(m_file.m_fd)).expect("fdatasync log");
+        }
+        m_file_size = valid;
+    }
+
+    static void _put_u32(char *p, std::uint32_t value) noexcept {
+        for (int i = 0; i < 4; i++) {
+            p[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    static std::uint32_t _get_u32(char const *p) noexcept {
+        std::uint32_t value = 0;
+        for (int i = 0; i < 4; i++) {
+            value |= std::uint32_t(static_cast<unsigned char>(p[i])) << (8 * i);
+        }
+        return value;
+    }
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "message_log.hpp"
+#include "reflect.hpp"
+
+// messages numbered from 0 in the order they are appended, only the last
+// retention ones are kept, in a ring buffer
+// a reader keeps a cursor, the number of the first message it does not have
+// yet, and reads from there: a poll costs O(new messages), not O(history)
+// the json of every message is encoded once, when it is appended, and the
+// json array of a page is cut out of it and shared by all its readers
+// thread safe, one store is shared by all the reactors
+// with a message_log, every message is appended to it as well (its json is
+// the record), and the messages kept are recovered from it on startup
+template <class T>
+struct message_store {
+    // a message is never modified once appended, readers share it
+    using pointer = std::shared_ptr<T>;
+
+    struct slice {
+        // the number of m_messages.front(), past the reader's cursor if
+        // the messages in between are no longer kept
+        uint64_t m_first = 0;
+        // the cursor of the next read
+        uint64_t m_next = 0;
+        std::vector<pointer> m_messages;
+    };
+
+    struct json_page {
+        uint64_t m_first = 0;
+        uint64_t m_next = 0;
+        // the json array of the messages [m_first, m_next), immutable
+        std::shared_ptr<std::string const> m_json;
+    };
+
+    std::mutex m_lock;
+    std::vector<pointer> m_ring;
+    // the number the next message gets
+    uint64_t m_head = 0;
+    // ",json" of every message kept, one after the other; message i starts
+    // at m_json_offsets[i % retention] - m_json_base
+    std::string m_json;
+    std::vector<uint64_t> m_json_offsets;
+    uint64_t m_json_base = 0;
+    // the last page built, handed out again until a message is appended
+    json_page m_page;
+    // the record of message i is record i of the log
+    message_log *m_log = nullptr;
+
+    explicit message_store(size_t retention = 65536)
+        : m_ring(retention), m_json_offsets(retention) {
+        assert(retention != 0);
+    }
+
+    message_store(message_store &&) = delete;
+
+    size_t retention() const noexcept {
+        return m_ring.size();
+    }
+
+    // recovers the messages of the previous runs from log, and appends to
+    // it from now on; before any append
+    void open_log(message_log &log) {
+        uint64_t count = log.open(retention(), [this](uint64_t number,
+                                                      std::string_view json) {
+            _restore(number, json);
+        });
+        m_head = count;
+        m_log = &log;
+    }
+
+    void _restore(uint64_t number, std::string_view json) {
+        T value;
+        std::error_code ec;
+        if (!reflect::json_decode(json, value, ec)) {
+            throw std::runtime_error("message_store: cannot decode message " +
+                                     std::to_string(number) + ": " + ec.message());
+        }
+        m_ring[number % m_ring.size()] = std::make_shared<T>(std::move(value));
+        m_json_offsets[number % m_ring.size()] = m_json_base + m_json.size();
+        m_json.push_back(',');
+        m_json.append(json);
+    }
+
+    // returns the number of the message; with a log, message_log::
+    // when_durable() tells once it is on disk
+    uint64_t append(T value) {
+        // encoded out of the lock
+        std::string json = ",";
+        reflect::json_encode(value, json);
+        std::string record;
+        if (m_log) {
+            record = message_log::make_record(std::string_view(json).substr(1));
+        }
+        auto message = std::make_shared<T>(std::move(value));
+        pointer dropped;
+        uint64_t number;
+        {
+            std::lock_guard guard(m_lock);
+            number = m_head++;
+            if (m_log) {
+                // in the order of the numbers
+                m_log->append_record(record);
+            }
+            dropped = std::exchange(m_ring[number % m_ring.size()],
+                                    std::move(message));
+            m_json_offsets[number % m_ring.size()] = m_json_base + m_json.size();
+            m_json.append(json);
+            _compact_json();
+            m_page.m_json = nullptr;
+        }
+        // the message falling out of the retention is freed out of the lock
+        return number;
+    }
+
+    // drops the json of the messages no longer kept once they are half of
+    // the buffer, the copy is amortized over the appends
+    void _compact_json() {
+        uint64_t dead = _json_offset(_oldest()) - m_json_base;
+        if (dead > 4096 && dead > m_json.size() / 2) {
+            m_json.erase(0, dead);
+            m_json_base += dead;
+        }
+    }
+
+    uint64_t _oldest() const noexcept {
+        return m_head > m_ring.size() ? m_head - m_ring.size() : 0;
+    }
+
+    uint64_t _json_offset(uint64_t number) const noexcept {
+        if (number == m_head) {
+            return m_json_base + m_json.size();
+        }
+        return m_json_offsets[number % m_ring.size()];
+    }
+
+    uint64_t head() {
+        std::lock_guard guard(m_lock);
+        return m_head;
+    }
+
+    // the first message of a read from cursor: the cursor itself, unless
+    // the messages there are no longer kept or it is past the head
+    uint64_t _first_from(uint64_t cursor) const noexcept {
+        return std::max(std::min(cursor, m_head), _oldest());
+    }
+
+    // the messages from cursor on, at most limit of them
+    slice read_from(uint64_t cursor,
+                    size_t limit = std::numeric_limits<size_t>::max()) {
+        slice result;
+        std::lock_guard guard(m_lock);
+        uint64_t first = _first_from(cursor);
+        uint64_t last = first + std::min<uint64_t>(m_head - first, limit);
+        result.m_first = first;
+        result.m_next = last;
+        result.m_messages.reserve(last - first);
+        for (uint64_t i = first; i != last; ++i) {
+            result.m_messages.push_back(m_ring[i % m_ring.size()]);
+        }
+        return result;
+    }
+
+    // the json array of every message from cursor on, copied from the
+    // pre-encoded json: no message is encoded again, and the readers of the
+    // same page share a single copy
+    json_page json_from(uint64_t cursor) {
+        static auto const empty = std::make_shared<std::string const>("[]");
+        std::lock_guard guard(m_lock);
+        uint64_t first = _first_from(cursor);
+        if (first == m_head) {
+            return {first, first, empty};
+        }
+        if (m_page.m_json && m_page.m_first == first) {
+            return m_page;
+        }
+        uint64_t begin = _json_offset(first) - m_json_base;
+        uint64_t end = m_json.size();
+        auto json = std::make_shared<std::string>();
+        json->reserve(end - begin + 1);
+        // the comma of the first message becomes the '['
+        json->push_back('[');
+        json->append(m_json, begin + 1, end - begin - 1);
+        json->push_back(']');
+        m_page = {first, m_head, std::move(json)};
+        return m_page;
+    }
+};
@@ -0,0 +1,948 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "reflect.hpp"
+
+namespace reflect {
+// MessagePack over the same reflection as json: a REFLECT type is a map
+// from member name to value, so it stays readable by any msgpack library,
+// and the errors are the JsonError ones
+template <class T, class = void>
+struct MsgpackTrait {
+    template <class Encoder>
+    static void putValue(Encoder *encoder, T const &value) {
+        static_assert(!std::is_same_v<T, T>,
+                      "the given type contains members that are not reflected, "
+                      "please add REFLECT macro to it");
+    }
+
+    template <class Reader>
+    static bool readValue(Reader *reader, T &value, std::error_code &ec) {
+        static_assert(!std::is_same_v<T, T>,
+                      "the given type contains members that are not reflected, "
+                      "please add REFLECT macro to it");
+        return false;
+    }
+};
+
+// appends to a buffer like BasicJsonEncoder does
+template <class Buffer>
+struct MsgpackEncoder {
+    Buffer *out;
+    std::size_t size;
+
+    explicit MsgpackEncoder(Buffer &buffer)
+        : out(&buffer), size(buffer.size()) {}
+
+    MsgpackEncoder(MsgpackEncoder &&) = delete;
+
+    ~MsgpackEncoder() {
+        out->resize(size);
+    }
+
+    char *reserve(std::size_t n) {
+        if (out->size() - size < n) [[unlikely]] {
+            out->resize(std::max(size + n, out->size() * 2));
+        }
+        return out->data() + size;
+    }
+
+    void put(char c) {
+        *reserve(1) = c;
+        ++size;
+    }
+
+    void put(char const *s, std::size_t len) {
+        std::memcpy(reserve(len), s, len);
+        size += len;
+    }
+
+    // the tag byte, then value in big endian
+    template <class U>
+    void putTagged(unsigned char tag, U value) {
+        static_assert(std::is_unsigned_v<U>);
+        char *p = reserve(1 + sizeof(U));
+        p[0] = static_cast<char>(tag);
+        for (std::size_t i = 0; i < sizeof(U); ++i) {
+            p[1 + i] = static_cast<char>(value >> (8 * (sizeof(U) - 1 - i)));
+        }
+        size += 1 + sizeof(U);
+    }
+
+    void putNil() {
+        put('\xc0');
+    }
+
+    void putBool(bool value) {
+        put(value ? '\xc3' : '\xc2');
+    }
+
+    void putUnsigned(std::uint64_t value) {
+        if (value < 0x80) {
+            put(static_cast<char>(value));
+        } else if (value <= 0xff) {
+            putTagged(0xcc, static_cast<std::uint8_t>(value));
+        } else if (value <= 0xffff) {
+            putTagged(0xcd, static_cast<std::uint16_t>(value));
+        } else if (value <= 0xffffffff) {
+            putTagged(0xce, static_cast<std::uint32_t>(value));
+        } else {
+            putTagged(0xcf, value);
+        }
+    }
+
+    // the smallest format that holds the value
+    void putSigned(std::int64_t value) {
+        if (value >= 0) {
+            putUnsigned(static_cast<std::uint64_t>(value));
+        } else if (value >= -32) {
+            put(static_cast<char>(value));
+        } else if (value >= INT8_MIN) {
+            putTagged(0xd0, static_cast<std::uint8_t>(value));
+        } else if (value >= INT16_MIN) {
+            putTagged(0xd1, static_cast<std::uint16_t>(value));
+        } else if (value >= INT32_MIN) {
+            putTagged(0xd2, static_cast<std::uint32_t>(value));
+        } else {
+            putTagged(0xd3, static_cast<std::uint64_t>(value));
+        }
+    }
+
+    template <class T>
+    void putArithmetic(T const &value) {
+        if constexpr (std::is_same_v<T, float>) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            putTagged(0xca, bits);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            double d = static_cast<double>(value);
+            std::uint64_t bits;
+            std::memcpy(&bits, &d, sizeof(bits));
+            putTagged(0xcb, bits);
+        } else if constexpr (std::is_signed_v<T>) {
+            putSigned(value);
+        } else {
+            putUnsigned(value);
+        }
+    }
+
+    void putString(char const *str, std::size_t len) {
+        if (len < 32) {
+            put(static_cast<char>(0xa0 | len));
+        } else if (len <= 0xff) {
+            putTagged(0xd9, static_cast<std::uint8_t>(len));
+        } else if (len <= 0xffff) {
+            putTagged(0xda, static_cast<std::uint16_t>(len));
+        } else {
+            putTagged(0xdb, static_cast<std::uint32_t>(len));
+        }
+        put(str, len);
+    }
+
+    void putArrayHeader(std::size_t n) {
+        if (n < 16) {
+            put(static_cast<char>(0x90 | n));
+        } else if (n <= 0xffff) {
+            putTagged(0xdc, static_cast<std::uint16_t>(n));
+        } else {
+            putTagged(0xdd, static_cast<std::uint32_t>(n));
+        }
+    }
+
+    void putMapHeader(std::size_t n) {
+        if (n < 16) {
+            put(static_cast<char>(0x80 | n));
+        } else if (n <= 0xffff) {
+            putTagged(0xde, static_cast<std::uint16_t>(n));
+        } else {
+            putTagged(0xdf, static_cast<std::uint32_t>(n));
+        }
+    }
+
+    template <class T>
+    void putValue(T const &value) {
+        MsgpackTrait<T>::putValue(this, value);
+    }
+};
+
+struct MsgpackReader {
+    std::string_view data;
+
+    bool need(std::size_t n, std::error_code &ec) {
+        if (data.size() < n) [[unlikely]] {
+            ec = make_error_code(JsonError::UnexpectedEnd);
+            return false;
+        }
+        return true;
+    }
+
+    // the next tag byte, -1 at the end
+    int peek(std::error_code &ec) {
+        if (!need(1, ec)) {
+            return -1;
+        }
+        return static_cast<unsigned char>(data.front());
+    }
+
+    // the size bytes after the tag, in big endian
+    std::uint64_t takeBig(std::size_t bytes) noexcept {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < bytes; ++i) {
+            value = value << 8 | static_cast<unsigned char>(data[1 + i]);
+        }
+        data.remove_prefix(1 + bytes);
+        return value;
+    }
+
+    // a nil at that spot means the member is missing, like in json
+    bool typeMismatch(std::error_code &ec) {
+        if (peek(ec) == 0xc0) {
+            ec = make_error_code(JsonError::NullEntry);
+        } else if (!ec) {
+            ec = make_error_code(JsonError::TypeMismatch);
+        }
+        return false;
+    }
+
+    bool readNil(std::error_code &ec) {
+        if (peek(ec) != 0xc0) {
+            return !ec && typeMismatch(ec);
+        }
+        data.remove_prefix(1);
+        return true;
+    }
+
+    bool readBool(bool &value, std::error_code &ec) {
+        int c = peek(ec);
+        if (c != 0xc2 && c != 0xc3) {
+            return !ec && typeMismatch(ec);
+        }
+        value = c == 0xc3;
+        data.remove_prefix(1);
+        return true;
+    }
+
+    // any integer format, converted to T; a float only into a float, so
+    // that a variant doesn't take 2.5 for its int alternative
+    template <class T>
+    bool readArithmetic(T &value, std::error_code &ec) {
+        int c = peek(ec);
+        if (c < 0) {
+            return false;
+        }
+        if (c < 0x80) {
+            value = static_cast<T>(c);
+            data.remove_prefix(1);
+            return true;
+        }
+        if (c >= 0xe0) {
+            value = static_cast<T>(static_cast<signed char>(c));
+            data.remove_prefix(1);
+            return true;
+        }
+        std::size_t bytes;
+        switch (c) {
+        case 0xcc: case 0xd0: bytes = 1; break;
+        case 0xcd: case 0xd1: bytes = 2; break;
+        case 0xce: case 0xd2: case 0xca: bytes = 4; break;
+        case 0xcf: case 0xd3: case 0xcb: bytes = 8; break;
+        default: return typeMismatch(ec);
+        }
+        if (std::is_integral_v<T> && (c == 0xca || c == 0xcb)) {
+            return typeMismatch(ec);
+        }
+        if (!need(1 + bytes, ec)) {
+            return false;
+        }
+        std::uint64_t raw = takeBig(bytes);
+        switch (c) {
+        case 0xca: {
+            auto bits = static_cast<std::uint32_t>(raw);
+            float f;
+            std::memcpy(&f, &bits, sizeof(f));
+            value = static_cast<T>(f);
+        } break;
+        case 0xcb: {
+            double d;
+            std::memcpy(&d, &raw, sizeof(d));
+            value = static_cast<T>(d);
+        } break;
+        case 0xd0: value = static_cast<T>(static_cast<std::int8_t>(raw)); break;
+        case 0xd1: value = static_cast<T>(static_cast<std::int16_t>(raw)); break;
+        case 0xd2: value = static_cast<T>(static_cast<std::int32_t>(raw)); break;
+        case 0xd3: value = static_cast<T>(static_cast<std::int64_t>(raw)); break;
+        default: value = static_cast<T>(raw); break;
+        }
+        return true;
+    }
+
+    // a view into the input, msgpack strings need no unescaping
+    bool readString(std::string_view &str, std::error_code &ec) {
+        int c = peek(ec);
+        std::size_t len;
+        if (0xa0 <= c && c <= 0xbf) {
+            len = static_cast<std::size_t>(c & 0x1f);
+            data.remove_prefix(1);
+        } else if (c == 0xd9 || c == 0xda || c == 0xdb) {
+            std::size_t bytes = std::size_t(1) << (c - 0xd9);
+            if (!need(1 + bytes, ec)) {
+                return false;
+            }
+            len = static_cast<std::size_t>(takeBig(bytes));
+        } else {
+            return !ec && typeMismatch(ec);
+        }
+        if (!need(len, ec)) {
+            return false;
+        }
+        str = data.substr(0, len);
+        data.remove_prefix(len);
+        return true;
+    }
+
+    // fixed is the fix format tag (0x90 or 0x80), tag16 the 16-bit one
+    bool readHeader(int fixed, int tag16, std::size_t &n, std::error_code &ec) {
+        n = 0;
+        int c = peek(ec);
+        if ((c & 0xf0) == fixed) {
+            n = static_cast<std::size_t>(c & 0x0f);
+            data.remove_prefix(1);
+        } else if (c == tag16 || c == tag16 + 1) {
+            std::size_t bytes = c == tag16 ? 2 : 4;
+            if (!need(1 + bytes, ec)) {
+                return false;
+            }
+            n = static_cast<std::size_t>(takeBig(bytes));
+        } else {
+            return !ec && typeMismatch(ec);
+        }
+        return true;
+    }
+
+    bool readArrayHeader(std::size_t &n, std::error_code &ec) {
+        return readHeader(0x90, 0xdc, n, ec);
+    }
+
+    bool readMapHeader(std::size_t &n, std::error_code &ec) {
+        return readHeader(0x80, 0xde, n, ec);
+    }
+
+    // skips one value, nested ones included, without recursion
+    bool skipValue(std::error_code &ec) {
+        std::size_t pending = 1;
+        while (pending != 0) {
+            --pending;
+            int c = peek(ec);
+            if (c < 0) {
+                return false;
+            }
+            std::size_t head = 1, body = 0;
+            if (c < 0x80 || c >= 0xe0 || c == 0xc0 || c == 0xc2 || c == 0xc3) {
+                // fixint, nil and bool are the tag alone
+            } else if (c < 0x90) {
+                pending += 2 * static_cast<std::size_t>(c & 0x0f);
+            } else if (c < 0xa0) {
+                pending += static_cast<std::size_t>(c & 0x0f);
+            } else if (c < 0xc0) {
+                body = static_cast<std::size_t>(c & 0x1f);
+            } else {
+                // the length bytes, then what they count
+                static constexpr unsigned char lengths[0x20] = {
+                    0, 0, 0, 0, 1, 2, 4, 1, 2, 4, 4, 8, 1, 2, 4, 8,
+                    1, 2, 4, 8, 0, 0, 0, 0, 0, 1, 2, 4, 2, 4, 2, 4};
+                static constexpr unsigned char fixed[0x20] = {
+                    0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+                    0, 0, 0, 0, 2, 3, 5, 9, 17, 0, 0, 0, 0, 0, 0, 0};
+                if (c == 0xc1) {
+                    ec = make_error_code(JsonError::UnexpectedToken);
+                    return false;
+                }
+                std::size_t bytes = lengths[c - 0xc0];
+                if ((0xc4 <= c && c <= 0xc9) || (0xd9 <= c && c <= 0xdb)) {
+                    // bin, ext and str: a length, ext adds a type byte
+                    if (!need(1 + bytes, ec)) {
+                        return false;
+                    }
+                    std::uint64_t len = 0;
+                    for (std::size_t i = 0; i < bytes; ++i) {
+                        len = len << 8 | static_cast<unsigned char>(data[1 + i]);
+                    }
+                    head += bytes + fixed[c - 0xc0];
+                    body = static_cast<std::size_t>(len);
+                } else if (0xd4 <= c && c <= 0xd8) {
+                    // fixext: a type byte and 1 to 16 bytes
+                    body = fixed[c - 0xc0];
+                } else if (0xdc <= c) {
+                    if (!need(1 + bytes, ec)) {
+                        return false;
+                    }
+                    std::uint64_t n = 0;
+                    for (std::size_t i = 0; i < bytes; ++i) {
+                        n = n << 8 | static_cast<unsigned char>(data[1 + i]);
+                    }
+                    head += bytes;
+                    pending += static_cast<std::size_t>(c >= 0xde ? 2 * n : n);
+                } else {
+                    // numbers
+                    body = bytes;
+                }
+            }
+            if (!need(head + body, ec)) {
+                return false;
+            }
+            data.remove_prefix(head + body);
+        }
+        return true;
+    }
+};
+
+struct MsgpackTraitPointerLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        if (value == nullptr) {
+            encoder->putNil();
+        } else {
+            encoder->putValue(*value);
+        }
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        using E = typename std::pointer_traits<T>::element_type;
+        if (reader->peek(ec) == 0xc0 && !std::is_pointer_v<T>) {
+            value = nullptr;
+            return reader->readNil(ec);
+        }
+        if (value == nullptr) {
+            if constexpr (std::is_pointer_v<T>) {
+                // nowhere to put it
+                return !ec && reader->typeMismatch(ec);
+            } else {
+                value = T(new E());
+            }
+        }
+        return MsgpackTrait<E>::readValue(reader, *value, ec);
+    }
+};
+
+template <class T>
+struct MsgpackIsFixedArray : std::false_type {};
+
+template <class T, std::size_t N>
+struct MsgpackIsFixedArray<std::array<T, N>> : std::true_type {};
+
+struct MsgpackTraitArrayLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        encoder->putArrayHeader(value.size());
+        for (auto const &element: value) {
+            MsgpackTrait<typename T::value_type>::putValue(encoder, element);
+        }
+    }
+
+    // the elements of chunk index of count, the header goes before the
+    // first chunk
+    template <class Encoder, class T>
+    static void putChunk(Encoder *encoder, T const &value, std::size_t index,
+                         std::size_t count) {
+        if (index == 0) {
+            encoder->putArrayHeader(value.size());
+        }
+        auto it = value.begin() + value.size() * index / count;
+        auto end = value.begin() + value.size() * (index + 1) / count;
+        for (; it != end; ++it) {
+            MsgpackTrait<typename T::value_type>::putValue(encoder, *it);
+        }
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        std::size_t n;
+        if (!reader->readArrayHeader(n, ec)) {
+            return false;
+        }
+        if constexpr (MsgpackIsFixedArray<T>::value) {
+            if (n != value.size()) {
+                ec = make_error_code(JsonError::TypeMismatch);
+                return false;
+            }
+            for (auto &element: value) {
+                if (!MsgpackTrait<typename T::value_type>::readValue(
+                        reader, element, ec)) {
+                    return false;
+                }
+            }
+        } else {
+            // every element takes a byte at least, a bogus count can't
+            // reserve more than the input
+            value.reserve(value.size() + std::min(n, reader->data.size()));
+            for (std::size_t i = 0; i < n; ++i) {
+                if (!MsgpackTrait<typename T::value_type>::readValue(
+                        reader, value.emplace_back(), ec)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+struct MsgpackTraitDictLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        encoder->putMapHeader(value.size());
+        for (auto const &[key, element]: value) {
+            encoder->putString(key.data(), key.size());
+            MsgpackTrait<typename T::mapped_type>::putValue(encoder, element);
+        }
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        std::size_t n;
+        if (!reader->readMapHeader(n, ec)) {
+            return false;
+        }
+        for (std::size_t i = 0; i < n; ++i) {
+            std::string_view key;
+            if (!reader->readString(key, ec)) {
+                return false;
+            }
+            auto &element = value.try_emplace(typename T::key_type(key)).first->second;
+            if (!MsgpackTrait<typename T::mapped_type>::readValue(reader, element,
+                                                                 ec)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct MsgpackTraitStringLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        encoder->putString(value.data(), value.size());
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        std::string_view str;
+        if (!reader->readString(str, ec)) {
+            return false;
+        }
+        value = T(str.data(), str.size());
+        return true;
+    }
+};
+
+struct MsgpackTraitNullLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &) {
+        encoder->putNil();
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &, std::error_code &ec) {
+        return reader->readNil(ec);
+    }
+};
+
+struct MsgpackTraitOptionalLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        if (value) {
+            encoder->putValue(*value);
+        } else {
+            encoder->putNil();
+        }
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        int c = reader->peek(ec);
+        if (c < 0) {
+            return false;
+        }
+        if (c == 0xc0) {
+            value = std::nullopt;
+            return reader->readNil(ec);
+        }
+        return MsgpackTrait<typename T::value_type>::readValue(
+            reader, value.emplace(), ec);
+    }
+};
+
+struct MsgpackTraitBooleanLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        encoder->putBool(value);
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        return reader->readBool(value, ec);
+    }
+};
+
+struct MsgpackTraitArithmeticLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        encoder->putArithmetic(value);
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        return reader->readArithmetic(value, ec);
+    }
+};
+
+// the value of the active alternative, without a tag; reading tries the
+// alternatives in order and keeps the first one that fits
+struct MsgpackTraitVariantLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        std::visit([&](auto const &arg) { encoder->putValue(arg); }, value);
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        return readAlternative(reader, value, ec,
+                               std::make_index_sequence<std::variant_size_v<T>>());
+    }
+
+    template <class T, std::size_t... Is>
+    static bool readAlternative(MsgpackReader *reader, T &value,
+                                std::error_code &ec, std::index_sequence<Is...>) {
+        auto start = reader->data;
+        auto tryOne = [&](auto index) {
+            constexpr std::size_t I = decltype(index)::value;
+            reader->data = start;
+            ec.clear();
+            return MsgpackTrait<std::variant_alternative_t<I, T>>::readValue(
+                reader, value.template emplace<I>(), ec);
+        };
+        return (tryOne(std::integral_constant<std::size_t, Is>()) || ...);
+    }
+};
+
+struct ReflectorMsgpackCount {
+    std::size_t count = 0;
+
+    template <class T>
+    void operator()(char const *, T &) {
+        ++count;
+    }
+};
+
+template <class Encoder>
+struct ReflectorMsgpackEncode {
+    Encoder *encoder;
+
+    template <class T>
+    void operator()(char const *name, T &value) {
+        encoder->putString(name, std::strlen(name));
+        encoder->putValue(value);
+    }
+};
+
+// like ReflectorJsonRead, for the types without REFLECT__FIELDS
+struct ReflectorMsgpackRead {
+    MsgpackReader *reader;
+    std::string_view key{};
+    std::error_code ec{};
+    std::size_t index = 0;
+    bool found = false;
+    bool failed = false;
+    std::vector<bool> seen{};
+
+    template <class T>
+    void operator()(char const *name, T &value) {
+        std::size_t i = index++;
+        if (seen.size() <= i) {
+            seen.resize(i + 1);
+        }
+        if (found || failed || key != name) {
+            return;
+        }
+        found = true;
+        seen[i] = true;
+        failed = !MsgpackTrait<T>::readValue(reader, value, ec);
+    }
+};
+
+// the members without a key are read from a nil
+struct ReflectorMsgpackReadMissing {
+    std::vector<bool> const *seen;
+    std::error_code ec{};
+    std::size_t index = 0;
+    bool failed = false;
+
+    template <class T>
+    void operator()(char const *, T &value) {
+        std::size_t i = index++;
+        if (failed || (i < seen->size() && (*seen)[i])) {
+            return;
+        }
+        MsgpackReader nil{std::string_view("\xc0", 1)};
+        failed = !MsgpackTrait<T>::readValue(&nil, value, ec);
+    }
+};
+
+template <class T, auto Member>
+inline bool msgpackReadMember(MsgpackReader *reader, T &value,
+                              std::error_code &ec) {
+    using M = typename JsonMemberOf<decltype(Member)>::type;
+    return MsgpackTrait<M>::readValue(reader, value.*Member, ec);
+}
+
+template <class T, std::size_t N>
+struct ReflectorMsgpackFields {
+    std::array<bool (*)(MsgpackReader *, T &, std::error_code &), N> read{};
+    std::size_t count = 0;
+
+    template <auto Member>
+    constexpr void field(char const *) {
+        read[count++] = &msgpackReadMember<T, Member>;
+    }
+};
+
+// one reader per field, in the order of JsonFieldTable<T>::names
+template <class T>
+inline constexpr auto msgpackFieldReaders = [] {
+    ReflectorMsgpackFields<T, JsonFieldTable<T>::count> reflector;
+    T::template REFLECT__FIELDS<T>(reflector);
+    return reflector.read;
+}();
+
+struct MsgpackTraitObjectLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        if constexpr (JsonHasFields<T>::value) {
+            encoder->putMapHeader(JsonFieldTable<T>::count);
+        } else {
+            ReflectorMsgpackCount counter;
+            reflect_members(counter, const_cast<T &>(value));
+            encoder->putMapHeader(counter.count);
+        }
+        ReflectorMsgpackEncode<Encoder> reflector{encoder};
+        reflect_members(reflector, const_cast<T &>(value));
+    }
+
+    template <class T>
+    static bool readValue(MsgpackReader *reader, T &value, std::error_code &ec) {
+        std::size_t n;
+        if (!reader->readMapHeader(n, ec)) {
+            return false;
+        }
+        if constexpr (JsonHasFields<T>::value) {
+            using Table = JsonFieldTable<T>;
+            std::array<bool, Table::count> seen{};
+            for (std::size_t k = 0; k < n; ++k) {
+                std::string_view key;
+                if (!reader->readString(key, ec)) {
+                    return false;
+                }
+                std::size_t i = Table::find(key);
+                if (i == Table::npos) {
+                    if (!reader->skipValue(ec)) {
+                        return false;
+                    }
+                    continue;
+                }
+                seen[i] = true;
+                if (!msgpackFieldReaders<T>[i](reader, value, ec)) {
+                    return false;
+                }
+            }
+            for (std::size_t i = 0; i < Table::count; ++i) {
+                MsgpackReader nil{std::string_view("\xc0", 1)};
+                if (!seen[i] && !msgpackFieldReaders<T>[i](&nil, value, ec)) {
+                    return false;
+                }
+            }
+            return true;
+        } else {
+            ReflectorMsgpackRead reflector{reader};
+            for (std::size_t k = 0; k < n; ++k) {
+                if (!reader->readString(reflector.key, ec)) {
+                    return false;
+                }
+                reflector.index = 0;
+                reflector.found = false;
+                reflect_members(reflector, value);
+                if (reflector.failed) {
+                    ec = reflector.ec;
+                    return false;
+                }
+                if (!reflector.found && !reader->skipValue(ec)) {
+                    return false;
+                }
+            }
+            ReflectorMsgpackReadMissing missing{&reflector.seen};
+            reflect_members(missing, value);
+            if (missing.failed) {
+                ec = missing.ec;
+                return false;
+            }
+            return true;
+        }
+    }
+};
+
+template <class T>
+struct MsgpackTrait<T *> : MsgpackTraitPointerLike {};
+
+template <class T, class Deleter>
+struct MsgpackTrait<std::unique_ptr<T, Deleter>> : MsgpackTraitPointerLike {};
+
+template <class T>
+struct MsgpackTrait<std::shared_ptr<T>> : MsgpackTraitPointerLike {};
+
+template <class T, std::size_t N>
+struct MsgpackTrait<std::array<T, N>> : MsgpackTraitArrayLike {};
+
+template <class T, class Alloc>
+struct MsgpackTrait<std::vector<T, Alloc>> : MsgpackTraitArrayLike {};
+
+template <class T, std::size_t Extent>
+struct MsgpackTrait<std::span<T, Extent>> : MsgpackTraitArrayLike {};
+
+template <class K, class V, class Cmp, class Alloc>
+struct MsgpackTrait<std::map<K, V, Cmp, Alloc>> : MsgpackTraitDictLike {};
+
+template <class K, class V, class Hash, class Eq, class Alloc>
+struct MsgpackTrait<std::unordered_map<K, V, Hash, Eq, Alloc>>
+    : MsgpackTraitDictLike {};
+
+template <class Traits, class Alloc>
+struct MsgpackTrait<std::basic_string<char, Traits, Alloc>>
+    : MsgpackTraitStringLike {};
+
+template <class Traits>
+struct MsgpackTrait<std::basic_string_view<char, Traits>>
+    : MsgpackTraitStringLike {};
+
+template <class... Ts>
+struct MsgpackTrait<std::variant<Ts...>> : MsgpackTraitVariantLike {};
+
+template <class T>
+struct MsgpackTrait<std::optional<T>> : MsgpackTraitOptionalLike {};
+
+template <>
+struct MsgpackTrait<std::nullptr_t> : MsgpackTraitNullLike {};
+
+template <>
+struct MsgpackTrait<std::nullopt_t> : MsgpackTraitNullLike {};
+
+template <>
+struct MsgpackTrait<std::monostate> : MsgpackTraitNullLike {};
+
+template <>
+struct MsgpackTrait<bool> : MsgpackTraitBooleanLike {};
+
+template <class T>
+struct MsgpackTrait<T, std::enable_if_t<std::is_arithmetic_v<T>>>
+    : MsgpackTraitArithmeticLike {};
+
+template <class T>
+struct MsgpackTrait<
+    T, std::void_t<decltype(reflect_members(
+           std::declval<ReflectorMsgpackCount &>(), std::declval<T &>()))>>
+    : MsgpackTraitObjectLike {};
+
+// appends the encoded value to out, which keeps what it already holds
+template <class T, class Buffer>
+inline void msgpack_encode(T const &value, Buffer &out) {
+    MsgpackEncoder<Buffer> encoder(out);
+    encoder.putValue(value);
+}
+
+template <class T>
+inline std::string msgpack_encode(T const &value) {
+    std::string data;
+    msgpack_encode(value, data);
+    return data;
+}
+
+template <class Encoder, class T>
+struct ReflectorMsgpackChunk {
+    Encoder *encoder;
+    T const *value;
+    std::size_t index;
+    std::size_t count;
+    std::size_t seen = 0;
+
+    template <auto Member>
+    void field(char const *name) {
+        using M = typename JsonMemberOf<decltype(Member)>::type;
+        bool last = ++seen == JsonFieldTable<T>::count;
+        if (index == 0) {
+            encoder->putString(name, std::strlen(name));
+            if (!last) {
+                MsgpackTrait<M>::putValue(encoder, value->*Member);
+            }
+        }
+        if constexpr (std::is_base_of_v<MsgpackTraitArrayLike, MsgpackTrait<M>>) {
+            if (last) {
+                MsgpackTraitArrayLike::putChunk(encoder, value->*Member, index,
+                                                count);
+            }
+        }
+    }
+};
+
+// chunk index of count of an array, or of an object whose last member is
+// one, joined in order the chunks are msgpack_encode(value), like
+// json_encode_chunk
+template <class T, class Buffer>
+inline void msgpack_encode_chunk(T const &value, std::size_t index,
+                                 std::size_t count, Buffer &out) {
+    MsgpackEncoder<Buffer> encoder(out);
+    if constexpr (std::is_base_of_v<MsgpackTraitArrayLike, MsgpackTrait<T>>) {
+        MsgpackTraitArrayLike::putChunk(&encoder, value, index, count);
+    } else {
+        static_assert(
+            chunkableLastField<T, MsgpackTraitArrayLike, MsgpackTrait>,
+            "only arrays, or objects ending with one, are chunked");
+        if (index == 0) {
+            encoder.putMapHeader(JsonFieldTable<T>::count);
+        }
+        ReflectorMsgpackChunk<MsgpackEncoder<Buffer>, T> reflector{
+            &encoder, &value, index, count};
+        T::template REFLECT__FIELDS<T>(reflector);
+    }
+}
+
+// string members that are views point into data
+template <class T>
+inline bool msgpack_decode(std::string_view data, T &value,
+                           std::error_code &ec) {
+    MsgpackReader reader{data};
+    return MsgpackTrait<T>::readValue(&reader, value, ec);
+}
+
+template <class T>
+inline T msgpack_decode(std::string_view data) {
+    T value{};
+    std::error_code ec;
+    if (!msgpack_decode(data, value, ec)) [[unlikely]] {
+        throw std::system_error(ec);
+    }
+    return value;
+}
+} // namespace reflect
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "callback.hpp"
+#include "io_context.hpp"
+
+struct reactor_pool {
+    std::vector<std::thread> m_threads;
+    callback<size_t> m_setup;
+    std::mutex m_error_lock;
+    std::exception_ptr m_error;
+    // the io_context of every running reactor, guarded by m_error_lock: the
+    // first error stops them all
+    std::vector<io_context *> m_contexts;
+    bool m_pin_cpu = false;
+    // the cpus the process may run on, reactor i is pinned to the i-th
+    std::vector<int> m_cpus;
+
+    reactor_pool() = default;
+    reactor_pool(reactor_pool &&) = delete;
+
+    // one reactor per cpu the process may run on (taskset, cpuset cgroup)
+    static size_t default_concurrency() noexcept {
+        size_t n = _allowed_cpus().size();
+        if (n == 0) {
+            n = std::thread::hardware_concurrency();
+        }
+        return n == 0 ? 1 : n;
+    }
+
+    // the affinity mask of the calling thread, empty if it is unknown
+    static std::vector<int> _allowed_cpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+            return cpus;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    void set_pin_cpu(bool pin) noexcept {
+        m_pin_cpu = pin;
+    }
+
+    // start n reactors, each one owns a thread and an io_context
+    // setup is called on every reactor thread with the reactor index,
+    // it should register the listeners of this reactor (e.g. an
+    // http_server, SO_REUSEPORT lets the kernel balance the accepts)
+    void start(size_t n, callback<size_t> setup) {
+        assert(m_threads.empty());
+        m_setup = std::move(setup);
+        if (m_pin_cpu) {
+            // read before any reactor is pinned
+            m_cpus = _allowed_cpus();
+        }
+        m_threads.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            m_threads.emplace_back([this, i] { _run(i); });
+        }
+    }
+
+    void _run(size_t index) {
+        try {
+            if (m_pin_cpu && !m_cpus.empty()) {
+                _pin_to_cpu(index, m_cpus[index % m_cpus.size()]);
+            }
+            io_context ctx;
+            _running running(*this, ctx);
+            m_setup(multishot_call, index);
+            ctx.join();
+        } catch (...) {
+            _fail(std::current_exception());
+        }
+    }
+
+    // m_contexts holds ctx while it is alive
+    struct _running {
+        reactor_pool &m_pool;
+        io_context &m_ctx;
+
+        _running(reactor_pool &pool, io_context &ctx) : m_pool(pool), m_ctx(ctx) {
+            std::lock_guard guard(m_pool.m_error_lock);
+            m_pool.m_contexts.push_back(&m_ctx);
+            if (m_pool.m_error) {
+                // another reactor failed before this one started
+                m_ctx.stop();
+            }
+        }
+
+        _running(_running &&) = delete;
+
+        ~_running() {
+            std::lock_guard guard(m_pool.m_error_lock);
+            auto &contexts = m_pool.m_contexts;
+            contexts.erase(std::find(contexts.begin(), contexts.end(), &m_ctx));
+        }
+    };
+
+    // the first error is rethrown by join(), which would otherwise wait
+    // forever on the reactors still serving
+    void _fail(std::exception_ptr error) {
+        std::lock_guard guard(m_error_lock);
+        if (m_error) {
+            return;
+        }
+        m_error = std::move(error);
+        for (io_context *ctx: m_contexts) {
+            ctx->stop();
+        }
+    }
+
+    // a reactor that cannot be pinned still runs, unpinned
+    static void _pin_to_cpu(size_t index, int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            std::cerr << "reactor " << index << ": cannot pin to cpu " << cpu
+                      << ": " << std::strerror(err) << '\n';
+        }
+    }
+
+    // wait for every reactor to finish, then rethrow the first error (the
+    // others are stopped once a reactor fails)
+    void join() {
+        for (auto &t: m_threads) {
+            t.join();
+        }
+        m_threads.clear();
+        if (m_error) {
+            std::rethrow_exception(std::exchange(m_error, nullptr));
+        }
+    }
+
+    ~reactor_pool() {
+        for (auto &t: m_threads) {
+            t.join();
+        }
+    }
+};
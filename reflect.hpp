@@ -1,11 +1,18 @@
 #pragma once
 
+#include <algorithm> 
 #include <array> 
+#include <charconv> 
+#include <cmath> 
 #include <cstddef> 
 #include <cstdint> 
+#include <cstring> 
+#include <limits> 
 #include <map> 
 #include <memory> 
+#include <new> 
 #include <optional> 
+#include <span> 
 #include <string> 
 #include <string_view> 
 #include <system_error>
@@ -13,6 +20,9 @@
 #include <unordered_map> 
 #include <variant> 
 #include <vector> 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace reflect {
 #if defined(_MSC_VER) && (!defined(_MSVC_TRADITIONAL) || _MSVC_TRADITIONAL)
@@ -148,10 +158,15 @@ namespace reflect {
 #  define REFLECT_GLOBAL_TEMPLATED__EXTRA(...)
 # endif
 # define REFLECT__ON_EACH(x) reflector(#x, x);
+# define REFLECT__FIELD_ON_EACH(x) \
+     reflector.template field<&REFLECT__Self::x>(#x);
 # define REFLECT(...) \
      template <class ReflectorT> \
      constexpr void REFLECT__MEMBERS(ReflectorT &reflector){ \
-         REFLECT__PP_FOREACH(REFLECT__ON_EACH, \
+         REFLECT__PP_FOREACH(REFLECT__ON_EACH, __VA_ARGS__)} \
+     template <class REFLECT__Self, class ReflectorT> \
+     static constexpr void REFLECT__FIELDS(ReflectorT &reflector){ \
+         REFLECT__PP_FOREACH(REFLECT__FIELD_ON_EACH, \
                              __VA_ARGS__)} REFLECT__EXTRA(__VA_ARGS__)
 # define REFLECT__GLOBAL_ON_EACH(x) \
      reflector(#x##_REFLECT__static_string, object.x);
@@ -242,11 +257,15 @@ struct JsonValue {
 /*     using value_type = T; */
 /* }; */
 
-struct JsonEncoder;
+template <class Buffer>
+struct BasicJsonEncoder;
+using JsonEncoder = BasicJsonEncoder<std::string>;
+struct JsonReader;
 
 template <class T, class = void>
 struct JsonTrait {
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder>
+    static void putValue(Encoder *encoder, T const &value) {
         static_assert(!std::is_same_v<T, T>,
                       "the given type contains members that are not reflected, "
                       "please add REFLECT macro to it");
@@ -259,29 +278,112 @@ struct JsonTrait {
                       "please add REFLECT macro to it");
         return false;
     }
+
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        static_assert(!std::is_same_v<T, T>,
+                      "the given type contains members that are not reflected, "
+                      "please add REFLECT macro to it");
+        return false;
+    }
 };
 
-struct JsonEncoder {
-    std::string json;
+inline bool jsonNeedsEscape(char c) noexcept {
+    auto u = static_cast<unsigned char>(c);
+    return u < 0x20 || u == '"' || u == '\\' || u == 0x7F;
+}
+
+// the length of the prefix of s that can be copied without escaping
+inline std::size_t jsonEscapeScan(char const *s, std::size_t n) noexcept {
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + i));
+        // unsigned v <= 0x1F, as max(v, 0x1F) == 0x1F
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, _mm256_set1_epi8(0x1F)),
+                                        _mm256_set1_epi8(0x1F));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7F))));
+        if (auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(hit))) {
+            return i + static_cast<std::size_t>(__builtin_ctz(mask));
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+        __m128i ctl = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(0x1F)),
+                                     _mm_set1_epi8(0x1F));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(ctl, _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7F))));
+        if (auto mask = static_cast<unsigned>(_mm_movemask_epi8(hit))) {
+            return i + static_cast<std::size_t>(__builtin_ctz(mask));
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (jsonNeedsEscape(s[i])) {
+            return i;
+        }
+    }
+    return n;
+}
+
+// appends to any contiguous buffer with data(), size() and resize(), e.g.
+// std::string, std::vector<char> or bytes_buffer; the buffer is grown ahead
+// and written through a pointer, the destructor trims it to the json
+template <class Buffer>
+struct BasicJsonEncoder {
+    Buffer *out;
+    std::size_t size;
+
+    explicit BasicJsonEncoder(Buffer &buffer)
+        : out(&buffer), size(buffer.size()) {}
+
+    BasicJsonEncoder(BasicJsonEncoder &&) = delete;
+
+    ~BasicJsonEncoder() {
+        out->resize(size);
+    }
+
+    // room for n more chars, returns where they go
+    char *reserve(std::size_t n) {
+        if (out->size() - size < n) [[unlikely]] {
+            out->resize(std::max(size + n, out->size() * 2));
+        }
+        return out->data() + size;
+    }
 
     void put(char c) {
-        json.push_back(c);
+        *reserve(1) = c;
+        ++size;
     }
 
     void put(char const *s, std::size_t len) {
-        json.append(s, len);
+        std::memcpy(reserve(len), s, len);
+        size += len;
     }
 
     void putLiterialString(char const *name) {
         put('"');
-        json.append(name);
+        put(name, std::strlen(name));
         put('"');
     }
 
-    void putString(char const *name, std::size_t len) {
+    void putString(char const *str, std::size_t len) {
         put('"');
-        for (char const *it = name, *ep = name + len; it != ep; ++it) {
-            char c = *it;
+        for (char const *ep = str + len;;) {
+            // clean runs are copied whole
+            std::size_t n = jsonEscapeScan(str, static_cast<std::size_t>(ep - str));
+            put(str, n);
+            str += n;
+            if (str == ep) {
+                break;
+            }
+            char c = *str++;
             switch (c) {
             case '\n': put("\\n", 2); break;
             case '\r': put("\\r", 2); break;
@@ -289,24 +391,51 @@ struct JsonEncoder {
             case '\\': put("\\\\", 2); break;
             case '\0': put("\\0", 2); break;
             case '"':  put("\\\"", 2); break;
-            default:
-                if ((c >= 0 && c < 0x20) || c == 0x7F) {
-                    put("\\u00", 4);
-                    auto u = static_cast<unsigned char>(c);
-                    put("0123456789abcdef"[u >> 4]);
-                    put("0123456789abcdef"[u & 0x0F]);
-                } else {
-                    put(c);
-                }
-                break;
+            default: {
+                auto u = static_cast<unsigned char>(c);
+                char esc[6] = {'\\', 'u', '0', '0', "0123456789abcdef"[u >> 4],
+                               "0123456789abcdef"[u & 0x0F]};
+                put(esc, 6);
+            } break;
             }
         }
         put('"');
     }
 
+    // the longest text to_chars() gives for a T
+    template <class T>
+    static constexpr std::size_t arithmeticMaxChars() {
+        if constexpr (std::is_floating_point_v<T>) {
+            using limits = std::numeric_limits<T>;
+            // -d.ddde-xxxx, the shortest form is never longer; subnormals
+            // go digits10 below min_exponent10
+            int exponent = std::max(limits::max_exponent10,
+                                    limits::digits10 - limits::min_exponent10);
+            std::size_t exponentDigits = 1;
+            while (exponent >= 10) {
+                exponent /= 10;
+                ++exponentDigits;
+            }
+            return 4 + limits::max_digits10 + exponentDigits;
+        } else {
+            // the sign and digits10 + 1 digits
+            return std::numeric_limits<T>::digits10 + 2;
+        }
+    }
+
     template <class T>
     void putArithmetic(T const &value) {
-        json.append(std::to_string(value));
+        constexpr std::size_t maxChars = arithmeticMaxChars<T>();
+        char *p = reserve(maxChars);
+        if constexpr (std::is_floating_point_v<T>) {
+            // json has no nan or inf
+            if (!std::isfinite(value)) {
+                put("null", 4);
+                return;
+            }
+        }
+        size = static_cast<std::size_t>(
+            std::to_chars(p, p + maxChars, value).ptr - out->data());
     }
 
     template <class T>
@@ -607,8 +736,372 @@ inline JsonValue::Ptr jsonParse(std::string_view &json, std::error_code &ec) {
     return current;
 }
 
+// the offset of the first quote or bracket in s, n if none; this is all
+// that skipping over a nested value needs to look at
+inline std::size_t jsonBracketScan(char const *s, std::size_t n) noexcept {
+    std::size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(s + i));
+        // '{' | 0x20 == '{' covers '[', same for '}' and ']'
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i hit = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+            _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('{')),
+                            _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('}'))));
+        if (auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(hit))) {
+            return i + static_cast<std::size_t>(__builtin_ctz(mask));
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(s + i));
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i hit = _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+            _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')),
+                         _mm_cmpeq_epi8(lower, _mm_set1_epi8('}'))));
+        if (auto mask = static_cast<unsigned>(_mm_movemask_epi8(hit))) {
+            return i + static_cast<std::size_t>(__builtin_ctz(mask));
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        char c = s[i] | 0x20;
+        if (s[i] == '"' || c == '{' || c == '}') {
+            return i;
+        }
+    }
+    return n;
+}
+
+// streaming (SAX-like) reader: the JsonTrait<T>::readValue functions pull
+// the tokens straight into the target, no JsonValue tree is built
+// it is as lax as jsonParse: commas are optional and trailing data ignored
+struct JsonReader {
+    std::string_view json;
+    // unescaped keys that are not plain views into json
+    std::string keyBuffer{};
+
+    // skips the blanks, false at the end of the input
+    bool skipSpace(std::error_code &ec) {
+        std::size_t i = 0;
+        while (i < json.size()) {
+            char c = json[i];
+            if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != '\0') {
+                break;
+            }
+            ++i;
+        }
+        json.remove_prefix(i);
+        if (json.empty()) {
+            ec = make_error_code(JsonError::UnexpectedEnd);
+            return false;
+        }
+        return true;
+    }
+
+    // the first char of the next value, or 0 at the end of the input
+    char peek(std::error_code &ec) {
+        return skipSpace(ec) ? json.front() : '\0';
+    }
+
+    bool expect(char c, std::error_code &ec) {
+        if (!skipSpace(ec)) {
+            return false;
+        }
+        if (json.front() != c) {
+            ec = make_error_code(JsonError::UnexpectedToken);
+            return false;
+        }
+        json.remove_prefix(1);
+        return true;
+    }
+
+    bool literal(std::string_view word, std::error_code &ec) {
+        if (json.substr(0, word.size()) != word) {
+            ec = make_error_code(JsonError::UnexpectedToken);
+            return false;
+        }
+        json.remove_prefix(word.size());
+        return true;
+    }
+
+    // in an array or a dict after its opening char: 1 if an element
+    // follows, 0 if close was reached (and consumed), -1 on error
+    int next(char close, std::error_code &ec) {
+        for (;;) {
+            if (!skipSpace(ec)) {
+                return -1;
+            }
+            char c = json.front();
+            if (c == close) {
+                json.remove_prefix(1);
+                return 0;
+            } else if (c == ',') {
+                json.remove_prefix(1);
+                continue;
+            }
+            return 1;
+        }
+    }
+
+    // like jsonParse, null in place of the expected value is a NullEntry
+    bool typeMismatch(std::error_code &ec) const {
+        if (json.substr(0, 4) == "null") {
+            ec = make_error_code(JsonError::NullEntry);
+        } else {
+            ec = make_error_code(JsonError::TypeMismatch);
+        }
+        return false;
+    }
+
+    // the raw content of the string at the front (escapes not decoded)
+    bool readRawString(std::string_view &raw, bool &escaped,
+                       std::error_code &ec) {
+        std::size_t i = 1;
+        escaped = false;
+        for (;;) {
+            auto p = static_cast<char const *>(
+                std::memchr(json.data() + i, '"', json.size() - i));
+            if (!p) {
+                ec = make_error_code(JsonError::NonTerminatedString);
+                return false;
+            }
+            std::size_t end = static_cast<std::size_t>(p - json.data());
+            // an odd number of backslashes escapes this quote
+            std::size_t slashes = 0;
+            while (json[end - 1 - slashes] == '\\') {
+                ++slashes;
+            }
+            if (slashes != 0 ||
+                std::memchr(json.data() + i, '\\', end - i) != nullptr) {
+                escaped = true;
+            }
+            if (slashes % 2 == 0) {
+                raw = json.substr(1, end - 1);
+                json.remove_prefix(end + 1);
+                return true;
+            }
+            i = end + 1;
+        }
+    }
+
+    static bool unescape(std::string_view raw, std::string &str,
+                         std::error_code &ec) {
+        auto readHex = [&](std::size_t i, unsigned int &hex) {
+            if (i + 4 > raw.size()) {
+                return false;
+            }
+            hex = 0;
+            for (std::size_t k = i; k < i + 4; ++k) {
+                char c = raw[k];
+                hex <<= 4;
+                if ('0' <= c && c <= '9') {
+                    hex |= static_cast<unsigned int>(c - '0');
+                } else if ('a' <= c && c <= 'f') {
+                    hex |= static_cast<unsigned int>(c - 'a' + 10);
+                } else if ('A' <= c && c <= 'F') {
+                    hex |= static_cast<unsigned int>(c - 'A' + 10);
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        };
+        auto unsignedExtent = [](unsigned int x) {
+            return static_cast<char>(static_cast<unsigned char>(x));
+        };
+        str.reserve(str.size() + raw.size());
+        std::size_t i = 0;
+        while (i < raw.size()) {
+            auto slash = raw.find('\\', i);
+            if (slash == raw.npos) {
+                str.append(raw.substr(i));
+                break;
+            }
+            str.append(raw.substr(i, slash - i));
+            i = slash + 1;
+            char c = raw[i++];
+            switch (c) {
+            case 'n': str.push_back('\n'); continue;
+            case 't': str.push_back('\t'); continue;
+            case '0': str.push_back('\0'); continue;
+            case 'r': str.push_back('\r'); continue;
+            case 'v': str.push_back('\v'); continue;
+            case 'f': str.push_back('\f'); continue;
+            case 'b': str.push_back('\b'); continue;
+            case 'a': str.push_back('\a'); continue;
+            case 'u': break;
+            default: str.push_back(c); continue;
+            }
+            unsigned int hex;
+            if (!readHex(i, hex)) {
+                ec = make_error_code(JsonError::InvalidUTF16String);
+                return false;
+            }
+            i += 4;
+            if (0xD800 <= hex && hex < 0xDC00) {
+                unsigned int low;
+                if (raw.substr(i, 2) != "\\u" || !readHex(i + 2, low) ||
+                    low < 0xDC00 || low >= 0xE000) {
+                    ec = make_error_code(JsonError::InvalidUTF16String);
+                    return false;
+                }
+                i += 6;
+                hex = 0x10000 + (hex - 0xD800) * 0x400 + (low - 0xDC00);
+            } else if (0xDC00 <= hex && hex < 0xE000) {
+                ec = make_error_code(JsonError::InvalidUTF16String);
+                return false;
+            }
+            if (hex <= 0x7F) {
+                str.push_back(unsignedExtent(hex));
+            } else if (hex <= 0x7FF) {
+                str.push_back(unsignedExtent(0xC0 | (hex >> 6)));
+                str.push_back(unsignedExtent(0x80 | (hex & 0x3F)));
+            } else if (hex <= 0xFFFF) {
+                str.push_back(unsignedExtent(0xE0 | (hex >> 12)));
+                str.push_back(unsignedExtent(0x80 | ((hex >> 6) & 0x3F)));
+                str.push_back(unsignedExtent(0x80 | (hex & 0x3F)));
+            } else {
+                str.push_back(unsignedExtent(0xF0 | (hex >> 18)));
+                str.push_back(unsignedExtent(0x80 | ((hex >> 12) & 0x3F)));
+                str.push_back(unsignedExtent(0x80 | ((hex >> 6) & 0x3F)));
+                str.push_back(unsignedExtent(0x80 | (hex & 0x3F)));
+            }
+        }
+        return true;
+    }
+
+    // replaces str with the string at the front
+    bool readString(std::string &str, std::error_code &ec) {
+        std::string_view raw;
+        bool escaped;
+        if (!readRawString(raw, escaped, ec)) {
+            return false;
+        }
+        str.clear();
+        if (!escaped) {
+            str.assign(raw);
+            return true;
+        }
+        return unescape(raw, str, ec);
+    }
+
+    // a dict key, valid until the next readKey
+    bool readKey(std::string_view &key, std::error_code &ec) {
+        if (!skipSpace(ec)) {
+            return false;
+        }
+        if (json.front() != '"') {
+            ec = make_error_code(JsonError::DictKeyNotString);
+            return false;
+        }
+        bool escaped;
+        if (!readRawString(key, escaped, ec)) {
+            return false;
+        }
+        if (escaped) {
+            keyBuffer.clear();
+            if (!unescape(key, keyBuffer, ec)) {
+                return false;
+            }
+            key = keyBuffer;
+        }
+        return expect(':', ec);
+    }
+
+    // the characters of the number at the front
+    bool readNumber(std::string_view &token, bool &isReal,
+                    std::error_code &ec) {
+        std::size_t i = 0;
+        isReal = false;
+        while (i < json.size()) {
+            char c = json[i];
+            if (c == '.' || c == 'e' || c == 'E') {
+                isReal = true;
+            } else if (!(('0' <= c && c <= '9') || c == '-' || c == '+')) {
+                break;
+            }
+            ++i;
+        }
+        token = json.substr(0, i);
+        json.remove_prefix(i);
+        if (!token.empty() && token.front() == '+') {
+            token.remove_prefix(1);
+        }
+        if (token.empty()) {
+            ec = make_error_code(JsonError::InvalidNumberFormat);
+            return false;
+        }
+        return true;
+    }
+
+    // skips the value at the front, for the keys no member matches; inside
+    // an array or object only the quotes and brackets are looked at, so a
+    // skipped value is not fully validated
+    bool skipValue(std::error_code &ec) {
+        if (!skipSpace(ec)) {
+            return false;
+        }
+        char c = json.front();
+        if (c == '"') {
+            std::string_view raw;
+            bool escaped;
+            return readRawString(raw, escaped, ec);
+        } else if (c == '}' || c == ']' || c == ',' || c == ':') {
+            ec = make_error_code(JsonError::UnexpectedToken);
+            return false;
+        } else if (c != '{' && c != '[') {
+            // number, true, false or null
+            auto end = json.find_first_of(",:]} \t\n\r");
+            json.remove_prefix(end == json.npos ? json.size() : end);
+            return true;
+        }
+        std::size_t depth = 0;
+        for (std::size_t i = 0;;) {
+            i += jsonBracketScan(json.data() + i, json.size() - i);
+            if (i == json.size()) {
+                ec = make_error_code(JsonError::UnexpectedEnd);
+                return false;
+            }
+            c = json[i];
+            if (c == '"') {
+                // to the closing quote, one not escaped by a backslash
+                for (;;) {
+                    auto p = static_cast<char const *>(std::memchr(
+                        json.data() + i + 1, '"', json.size() - i - 1));
+                    if (!p) {
+                        ec = make_error_code(JsonError::NonTerminatedString);
+                        return false;
+                    }
+                    i = static_cast<std::size_t>(p - json.data());
+                    std::size_t slashes = 0;
+                    while (json[i - 1 - slashes] == '\\') {
+                        ++slashes;
+                    }
+                    if (slashes % 2 == 0) {
+                        break;
+                    }
+                }
+            } else if ((c | 0x20) == '{') {
+                ++depth;
+            } else if (--depth == 0) {
+                json.remove_prefix(i + 1);
+                return true;
+            }
+            ++i;
+        }
+    }
+};
+
+template <class T>
+constexpr std::size_t jsonSizeHint();
+
+template <class Encoder>
 struct ReflectorJsonEncode {
-    JsonEncoder *encoder;
+    Encoder *encoder;
     bool comma = false;
 
     template <class T>
@@ -686,86 +1179,449 @@ struct ReflectorJsonDecode {
     }
 };
 
-struct JsonTraitPointerLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
-        if (value == nullptr) {
-            encoder->put("null", 4);
+// matches a key against the reflected members, and reads the value
+// straight into the matching one
+struct ReflectorJsonRead {
+    JsonReader *reader;
+    std::string_view key{};
+    std::error_code ec{};
+    std::size_t index = 0;
+    bool found = false;
+    bool failed = false;
+    // the members whose key was seen, past the 64th in seenMore
+    std::uint64_t seen = 0;
+    std::vector<bool> seenMore{};
+
+    void markSeen(std::size_t i) {
+        if (i < 64) {
+            seen |= std::uint64_t(1) << i;
         } else {
-            JsonTrait<typename std::pointer_traits<T>::element_type>::putValue(
-                encoder, *value);
+            if (seenMore.size() <= i - 64) {
+                seenMore.resize(i - 63);
+            }
+            seenMore[i - 64] = true;
         }
     }
 
-    template <class T>
-    static bool getValue(JsonValue::Union const &inner, T &value,
-                         std::error_code &ec) {
-        JsonTrait<typename std::pointer_traits<T>::element_type>::getValue(
-            inner, *value, ec);
-        return !ec;
+    bool isSeen(std::size_t i) const {
+        if (i < 64) {
+            return seen & (std::uint64_t(1) << i);
+        }
+        return i - 64 < seenMore.size() && seenMore[i - 64];
     }
-};
 
-struct JsonTraitArrayLike {
     template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
-        auto bit = value.begin();
-        auto eit = value.end();
-        encoder->put('[');
-        bool comma = false;
-        for (auto it = bit; it != eit; ++it) {
-            if (!comma) {
-                comma = true;
-            } else {
-                encoder->put(',');
-            }
-            JsonTrait<typename T::value_type>::putValue(encoder, *it);
+    void operator()(char const *name, T &value) {
+        std::size_t i = index++;
+        if (found || failed || key != name) {
+            return;
         }
-        encoder->put(']');
+        found = true;
+        markSeen(i);
+        failed = !JsonTrait<T>::readValue(reader, value, ec);
     }
+};
+
+// members without a key in the input are decoded from null, like
+// ReflectorJsonDecode does for the keys missing from the dict
+struct ReflectorJsonReadMissing {
+    ReflectorJsonRead const *read;
+    std::error_code ec{};
+    std::size_t index = 0;
+    bool failed = false;
 
     template <class T>
-    static bool getValue(JsonValue::Union &data, T &value,
-                         std::error_code &ec) {
-        if (auto p = std::get_if<JsonValue::Array>(&data)) {
-            auto bit = p->begin();
-            auto eit = p->end();
-            for (auto it = bit; it != eit; ++it) {
-                auto &element = value.emplace_back();
-                if (!JsonTrait<typename T::value_type>::getValue((*it)->inner,
-                                                                 element, ec)) {
-                    return false;
-                }
-            }
-            return true;
-        } else {
-            ReflectorJsonDecode::typeMismatch("array", data, ec);
-            return false;
+    void operator()(char const *, T &value) {
+        std::size_t i = index++;
+        if (failed || read->isSeen(i)) {
+            return;
         }
+        JsonValue::Union nullData;
+        failed = !JsonTrait<T>::getValue(nullData, value, ec);
     }
 };
 
-struct JsonTraitDictLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
-        auto bit = value.begin();
-        auto eit = value.end();
-        encoder->put('{');
-        bool comma = false;
-        for (auto it = bit; it != eit; ++it) {
-            if (!comma) {
-                comma = true;
-            } else {
-                encoder->put(',');
-            }
-            encoder->putString(it->first);
-            encoder->put(':');
-            JsonTrait<typename T::mapped_type>::putValue(encoder, it->second);
-        }
-        encoder->put('}');
+template <class P>
+struct JsonMemberOf;
+
+template <class M, class C>
+struct JsonMemberOf<M C::*> {
+    using type = M;
+};
+
+struct ReflectorJsonFieldCount {
+    std::size_t count = 0;
+
+    template <auto Member>
+    constexpr void field(char const *) {
+        ++count;
     }
+};
 
-    template <class T>
+template <class T, class = void>
+struct JsonHasFields : std::false_type {};
+
+template <class T>
+struct JsonHasFields<T, std::void_t<decltype(T::template REFLECT__FIELDS<T>(
+                            std::declval<ReflectorJsonFieldCount &>()))>>
+    : std::true_type {};
+
+template <class T, auto Member>
+inline bool jsonReadMember(JsonReader *reader, T &value, std::error_code &ec) {
+    using M = typename JsonMemberOf<decltype(Member)>::type;
+    return JsonTrait<M>::readValue(reader, value.*Member, ec);
+}
+
+template <class T, auto Member>
+inline bool jsonGetMember(JsonValue::Union &data, T &value,
+                          std::error_code &ec) {
+    using M = typename JsonMemberOf<decltype(Member)>::type;
+    return JsonTrait<M>::getValue(data, value.*Member, ec);
+}
+
+template <std::size_t N>
+struct ReflectorJsonFieldNames {
+    std::array<std::string_view, N> names{};
+    std::size_t count = 0;
+
+    template <auto Member>
+    constexpr void field(char const *name) {
+        names[count++] = name;
+    }
+};
+
+// the readers and getters are apart from the names, so that another
+// format using the names doesn't instantiate the json functions
+template <class T, std::size_t N>
+struct ReflectorJsonFieldReaders {
+    std::array<bool (*)(JsonReader *, T &, std::error_code &), N> read{};
+    std::size_t count = 0;
+
+    template <auto Member>
+    constexpr void field(char const *) {
+        read[count++] = &jsonReadMember<T, Member>;
+    }
+};
+
+template <class T, std::size_t N>
+struct ReflectorJsonFieldGetters {
+    std::array<bool (*)(JsonValue::Union &, T &, std::error_code &), N> get{};
+    std::size_t count = 0;
+
+    template <auto Member>
+    constexpr void field(char const *) {
+        get[count++] = &jsonGetMember<T, Member>;
+    }
+};
+
+constexpr std::size_t jsonKeySlot(std::string_view key, std::uint32_t seed,
+                                  std::size_t mask) noexcept {
+    std::uint32_t h = 2166136261u ^ seed;
+    for (char c: key) {
+        h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    return (h ^ (h >> 15)) & mask;
+}
+
+// a perfect hash from the names of a REFLECT type to its fields: the seed
+// is searched at compile time so that no two names share a slot, then a
+// key costs one hash and one compare, and each field is read through its
+// own function
+template <class T>
+struct JsonFieldTable;
+
+// the json readers and getters of the fields, in the order of the names
+template <class T>
+inline constexpr auto jsonFieldReaders = [] {
+    ReflectorJsonFieldReaders<T, JsonFieldTable<T>::count> reflector;
+    T::template REFLECT__FIELDS<T>(reflector);
+    return reflector.read;
+}();
+
+template <class T>
+inline constexpr auto jsonFieldGetters = [] {
+    ReflectorJsonFieldGetters<T, JsonFieldTable<T>::count> reflector;
+    T::template REFLECT__FIELDS<T>(reflector);
+    return reflector.get;
+}();
+
+template <class T>
+struct JsonFieldTable {
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    static constexpr std::size_t count = [] {
+        ReflectorJsonFieldCount reflector;
+        T::template REFLECT__FIELDS<T>(reflector);
+        return reflector.count;
+    }();
+    static_assert(count < 255, "too many reflected members");
+
+    static constexpr std::array<std::string_view, count> names = [] {
+        ReflectorJsonFieldNames<count> reflector;
+        T::template REFLECT__FIELDS<T>(reflector);
+        return reflector.names;
+    }();
+
+
+    // the smallest table of at least 4 slots per name that has a seed
+    static constexpr std::pair<std::size_t, std::uint32_t> layout = [] {
+        std::size_t size = 4;
+        while (size < count * 4) {
+            size *= 2;
+        }
+        for (;; size *= 2) {
+            for (std::uint32_t seed = 0; seed < 1024; ++seed) {
+                std::array<bool, 1024> used{};
+                bool collided = false;
+                for (std::size_t i = 0; i < count && !collided; ++i) {
+                    auto slot = jsonKeySlot(names[i], seed, size - 1);
+                    collided = used[slot];
+                    used[slot] = true;
+                }
+                if (!collided) {
+                    return std::pair{size, seed};
+                }
+            }
+        }
+    }();
+    static_assert(layout.first <= 1024, "no perfect hash for the members");
+
+    static constexpr std::size_t mask = layout.first - 1;
+    static constexpr std::uint32_t seed = layout.second;
+
+    // the index of the field plus one, 0 for an empty slot
+    static constexpr std::array<std::uint8_t, mask + 1> slots = [] {
+        std::array<std::uint8_t, mask + 1> slots{};
+        for (std::size_t i = 0; i < count; ++i) {
+            slots[jsonKeySlot(names[i], seed, mask)] =
+                static_cast<std::uint8_t>(i + 1);
+        }
+        return slots;
+    }();
+
+    static std::size_t find(std::string_view key) noexcept {
+        std::size_t i = slots[jsonKeySlot(key, seed, mask)];
+        if (i != 0 && names[i - 1] == key) {
+            return i - 1;
+        }
+        return npos;
+    }
+
+    // the fields without a key in the input are decoded from null
+    static bool getMissing(std::array<bool, count> const &seen, T &value,
+                           std::error_code &ec) {
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!seen[i]) {
+                JsonValue::Union nullData;
+                if (!jsonFieldGetters<T>[i](nullData, value, ec)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+struct JsonTraitPointerLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        if (value == nullptr) {
+            encoder->put("null", 4);
+        } else {
+            JsonTrait<typename std::pointer_traits<T>::element_type>::putValue(
+                encoder, *value);
+        }
+    }
+
+    // null is nullptr, an empty smart pointer gets a new element, a null
+    // raw pointer has nowhere to put it
+    template <class T>
+    static bool getValue(JsonValue::Union &data, T &value,
+                         std::error_code &ec) {
+        using E = typename std::pointer_traits<T>::element_type;
+        if (std::holds_alternative<JsonValue::Null>(data) &&
+            !std::is_pointer_v<T>) {
+            value = nullptr;
+            return true;
+        }
+        if (value == nullptr) {
+            if constexpr (std::is_pointer_v<T>) {
+                ec = make_error_code(JsonError::TypeMismatch);
+                return false;
+            } else {
+                value = T(new E());
+            }
+        }
+        return JsonTrait<E>::getValue(data, *value, ec);
+    }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        using E = typename std::pointer_traits<T>::element_type;
+        char c = reader->peek(ec);
+        if (ec) {
+            return false;
+        }
+        if (c == 'n' && !std::is_pointer_v<T>) {
+            value = nullptr;
+            return reader->literal("null", ec);
+        }
+        if (value == nullptr) {
+            if constexpr (std::is_pointer_v<T>) {
+                ec = make_error_code(JsonError::TypeMismatch);
+                return false;
+            } else {
+                value = T(new E());
+            }
+        }
+        return JsonTrait<E>::readValue(reader, *value, ec);
+    }
+};
+
+// decoded in place, the number of elements must match
+template <class T>
+struct JsonIsFixedArray : std::false_type {};
+
+template <class T, std::size_t N>
+struct JsonIsFixedArray<std::array<T, N>> : std::true_type {};
+
+template <class T, std::size_t Extent>
+struct JsonIsFixedArray<std::span<T, Extent>> : std::true_type {};
+
+struct JsonTraitArrayLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        constexpr std::size_t hint = jsonSizeHint<typename T::value_type>() + 1;
+        encoder->reserve(value.size() * hint + 2);
+        auto bit = value.begin();
+        auto eit = value.end();
+        encoder->put('[');
+        bool comma = false;
+        for (auto it = bit; it != eit; ++it) {
+            if (!comma) {
+                comma = true;
+            } else {
+                encoder->put(',');
+            }
+            JsonTrait<typename T::value_type>::putValue(encoder, *it);
+        }
+        encoder->put(']');
+    }
+
+    // the elements of chunk index of count, with the '[' before the first
+    // chunk and the ']' after the last one
+    template <class Encoder, class T>
+    static void putChunk(Encoder *encoder, T const &value, std::size_t index,
+                         std::size_t count) {
+        constexpr std::size_t hint = jsonSizeHint<typename T::value_type>() + 1;
+        std::size_t first = value.size() * index / count;
+        std::size_t last = value.size() * (index + 1) / count;
+        encoder->reserve((last - first) * hint + 2);
+        if (index == 0) {
+            encoder->put('[');
+        }
+        auto it = value.begin() + first;
+        for (std::size_t i = first; i != last; ++i, ++it) {
+            if (i != 0) {
+                encoder->put(',');
+            }
+            JsonTrait<typename T::value_type>::putValue(encoder, *it);
+        }
+        if (index + 1 == count) {
+            encoder->put(']');
+        }
+    }
+
+    template <class T>
+    static bool getValue(JsonValue::Union &data, T &value,
+                         std::error_code &ec) {
+        if (auto p = std::get_if<JsonValue::Array>(&data)) {
+            if constexpr (JsonIsFixedArray<T>::value) {
+                if (p->size() != value.size()) {
+                    ec = make_error_code(JsonError::TypeMismatch);
+                    return false;
+                }
+            } else {
+                value.clear();
+            }
+            std::size_t i = 0;
+            for (auto const &item: *p) {
+                auto &element = _element(value, i++);
+                if (!JsonTrait<typename T::value_type>::getValue(item->inner,
+                                                                 element, ec)) {
+                    return false;
+                }
+            }
+            return true;
+        } else {
+            ReflectorJsonDecode::typeMismatch("array", data, ec);
+            return false;
+        }
+    }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        if (reader->peek(ec) != '[') {
+            return !ec && reader->typeMismatch(ec);
+        }
+        reader->json.remove_prefix(1);
+        if constexpr (!JsonIsFixedArray<T>::value) {
+            value.clear();
+        }
+        for (std::size_t i = 0;; ++i) {
+            int more = reader->next(']', ec);
+            if (more < 0) {
+                return false;
+            }
+            if constexpr (JsonIsFixedArray<T>::value) {
+                if ((more == 0) != (i == value.size())) {
+                    ec = make_error_code(JsonError::TypeMismatch);
+                    return false;
+                }
+            }
+            if (more == 0) {
+                return true;
+            }
+            auto &element = _element(value, i);
+            if (!JsonTrait<typename T::value_type>::readValue(reader, element,
+                                                             ec)) {
+                return false;
+            }
+        }
+    }
+
+    // element i, appended unless the array is fixed
+    template <class T>
+    static typename T::value_type &_element(T &value, std::size_t i) {
+        if constexpr (JsonIsFixedArray<T>::value) {
+            return value[i];
+        } else {
+            return value.emplace_back();
+        }
+    }
+};
+
+struct JsonTraitDictLike {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        auto bit = value.begin();
+        auto eit = value.end();
+        encoder->put('{');
+        bool comma = false;
+        for (auto it = bit; it != eit; ++it) {
+            if (!comma) {
+                comma = true;
+            } else {
+                encoder->put(',');
+            }
+            encoder->putString(it->first.data(), it->first.size());
+            encoder->put(':');
+            JsonTrait<typename T::mapped_type>::putValue(encoder, it->second);
+        }
+        encoder->put('}');
+    }
+
+    template <class T>
     static bool getValue(JsonValue::Union &data, T &value,
                          std::error_code &ec) {
         if (auto p = std::get_if<JsonValue::Dict>(&data)) {
@@ -784,11 +1640,34 @@ struct JsonTraitDictLike {
             return false;
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        if (reader->peek(ec) != '{') {
+            return !ec && reader->typeMismatch(ec);
+        }
+        reader->json.remove_prefix(1);
+        for (;;) {
+            int more = reader->next('}', ec);
+            if (more <= 0) {
+                return more == 0;
+            }
+            std::string_view key;
+            if (!reader->readKey(key, ec)) {
+                return false;
+            }
+            auto &element = value.try_emplace(std::string(key)).first->second;
+            if (!JsonTrait<typename T::mapped_type>::readValue(reader, element,
+                                                              ec)) {
+                return false;
+            }
+        }
+    }
 };
 
 struct JsonTraitStringLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         encoder->putString(value.data(), value.size());
     }
 
@@ -803,11 +1682,35 @@ struct JsonTraitStringLike {
             return false;
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        if (reader->peek(ec) != '"') {
+            return !ec && reader->typeMismatch(ec);
+        }
+        if constexpr (std::is_same_v<T, std::basic_string_view<
+                                            char, typename T::traits_type>>) {
+            // a view into the input, only possible without escapes
+            std::string_view raw;
+            bool escaped;
+            if (!reader->readRawString(raw, escaped, ec)) {
+                return false;
+            }
+            if (escaped) {
+                ec = make_error_code(JsonError::NotImplemented);
+                return false;
+            }
+            value = T(raw.data(), raw.size());
+            return true;
+        } else {
+            return reader->readString(value, ec);
+        }
+    }
 };
 
 struct JsonTraitNullLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         encoder->put("null", 4);
     }
 
@@ -821,11 +1724,19 @@ struct JsonTraitNullLike {
             return false;
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        if (reader->peek(ec) != 'n') {
+            return !ec && reader->typeMismatch(ec);
+        }
+        return reader->literal("null", ec);
+    }
 };
 
 struct JsonTraitOptionalLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         if (value) {
             encoder->putValue(*value);
         } else {
@@ -844,11 +1755,25 @@ struct JsonTraitOptionalLike {
                 data, value.emplace(), ec);
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        char c = reader->peek(ec);
+        if (ec) {
+            return false;
+        }
+        if (c == 'n') {
+            value = std::nullopt;
+            return reader->literal("null", ec);
+        }
+        return JsonTrait<typename T::value_type>::readValue(
+            reader, value.emplace(), ec);
+    }
 };
 
 struct JsonTraitBooleanLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         if (value) {
             encoder->put("true", 4);
         } else {
@@ -867,11 +1792,24 @@ struct JsonTraitBooleanLike {
             return false;
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        char c = reader->peek(ec);
+        if (c == 't') {
+            value = true;
+            return reader->literal("true", ec);
+        } else if (c == 'f') {
+            value = false;
+            return reader->literal("false", ec);
+        }
+        return !ec && reader->typeMismatch(ec);
+    }
 };
 
 struct JsonTraitArithmeticLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         encoder->putArithmetic(value);
     }
 
@@ -889,11 +1827,51 @@ struct JsonTraitArithmeticLike {
             return false;
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        char c = reader->peek(ec);
+        if (!(('0' <= c && c <= '9') || c == '.' || c == '-' || c == '+')) {
+            return !ec && reader->typeMismatch(ec);
+        }
+        std::string_view token;
+        bool isReal;
+        if (!reader->readNumber(token, isReal, ec)) {
+            return false;
+        }
+        auto first = token.data(), last = token.data() + token.size();
+        if (!isReal) {
+            // integers go through int64 like jsonParse, the unsigned ones
+            // above its range through uint64
+            std::int64_t i;
+            auto res = std::from_chars(first, last, i);
+            if (res.ec == std::errc() && res.ptr == last) {
+                value = static_cast<T>(i);
+                return true;
+            }
+            if (std::is_unsigned_v<T> && res.ec == std::errc::result_out_of_range) {
+                std::uint64_t u;
+                res = std::from_chars(first, last, u);
+                if (res.ec == std::errc() && res.ptr == last) {
+                    value = static_cast<T>(u);
+                    return true;
+                }
+            }
+        }
+        double d;
+        auto res = std::from_chars(first, last, d);
+        if (res.ec != std::errc() || res.ptr != last) {
+            ec = make_error_code(JsonError::InvalidNumberFormat);
+            return false;
+        }
+        value = static_cast<T>(d);
+        return true;
+    }
 };
 
 struct JsonTraitVariantLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         std::visit([&](auto const &arg) { encoder->putValue(arg); }, value);
     }
 
@@ -908,11 +1886,17 @@ struct JsonTraitVariantLike {
         /*     encoder->getValue(data, arg, ec); */
         /* }, data.inner); */
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        ec = make_error_code(JsonError::NotImplemented);
+        return false;
+    }
 };
 
 struct JsonTraitJsonValueLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         encoder->putValue(value.inner);
     }
 
@@ -922,12 +1906,23 @@ struct JsonTraitJsonValueLike {
         value.inner = std::move(data);
         return true;
     }
+
+    // a JsonValue member still needs the tree, for that value only
+    static bool readValue(JsonReader *reader, JsonValue &value,
+                          std::error_code &ec) {
+        auto root = jsonParse(reader->json, ec);
+        if (!root) {
+            return false;
+        }
+        value.inner = std::move(root->inner);
+        return true;
+    }
 };
 
 struct JsonTraitObjectLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
-        ReflectorJsonEncode reflector{encoder};
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
+        ReflectorJsonEncode<Encoder> reflector{encoder};
         encoder->put('{');
         reflect_members(reflector, const_cast<T &>(value));
         encoder->put('}');
@@ -937,23 +1932,107 @@ struct JsonTraitObjectLike {
     static bool getValue(JsonValue::Union &data, T &value,
                          std::error_code &ec) {
         if (auto p = std::get_if<JsonValue::Dict>(&data)) {
-            ReflectorJsonDecode reflector{p};
-            reflect_members(reflector, value);
-            if (reflector.failed) {
-                ec = reflector.ec;
-                return false;
+            if constexpr (JsonHasFields<T>::value) {
+                using Table = JsonFieldTable<T>;
+                std::array<bool, Table::count> seen{};
+                for (auto &[key, child]: *p) {
+                    std::size_t i = Table::find(key);
+                    if (i == Table::npos) {
+                        continue;
+                    }
+                    seen[i] = true;
+                    if (!jsonFieldGetters<T>[i](child->inner, value, ec)) {
+                        return false;
+                    }
+                }
+                return Table::getMissing(seen, value, ec);
+            } else {
+                ReflectorJsonDecode reflector{p};
+                reflect_members(reflector, value);
+                if (reflector.failed) {
+                    ec = reflector.ec;
+                    return false;
+                }
+                return true;
             }
-            return true;
         } else {
             ReflectorJsonDecode::typeMismatch("object", data, ec);
             return false;
         }
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        if (reader->peek(ec) != '{') {
+            return !ec && reader->typeMismatch(ec);
+        }
+        reader->json.remove_prefix(1);
+        if constexpr (JsonHasFields<T>::value) {
+            using Table = JsonFieldTable<T>;
+            std::array<bool, Table::count> seen{};
+            for (;;) {
+                int more = reader->next('}', ec);
+                if (more < 0) {
+                    return false;
+                } else if (more == 0) {
+                    break;
+                }
+                std::string_view key;
+                if (!reader->readKey(key, ec)) {
+                    return false;
+                }
+                std::size_t i = Table::find(key);
+                if (i == Table::npos) {
+                    // unknown keys are skipped
+                    if (!reader->skipValue(ec)) {
+                        return false;
+                    }
+                    continue;
+                }
+                seen[i] = true;
+                if (!jsonFieldReaders<T>[i](reader, value, ec)) {
+                    return false;
+                }
+            }
+            return Table::getMissing(seen, value, ec);
+        } else {
+            ReflectorJsonRead reflector{reader};
+            for (;;) {
+                int more = reader->next('}', ec);
+                if (more < 0) {
+                    return false;
+                } else if (more == 0) {
+                    break;
+                }
+                if (!reader->readKey(reflector.key, ec)) {
+                    return false;
+                }
+                reflector.index = 0;
+                reflector.found = false;
+                reflect_members(reflector, value);
+                if (reflector.failed) {
+                    ec = reflector.ec;
+                    return false;
+                }
+                // unknown keys are ignored
+                if (!reflector.found && !reader->skipValue(ec)) {
+                    return false;
+                }
+            }
+            ReflectorJsonReadMissing missing{&reflector};
+            reflect_members(missing, value);
+            if (missing.failed) {
+                ec = missing.ec;
+                return false;
+            }
+            return true;
+        }
+    }
 };
 
 struct JsonTraitWrapperLike {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         return JsonTrait<typename T::value_type>::putValue(encoder, *value);
     }
 
@@ -962,12 +2041,17 @@ struct JsonTraitWrapperLike {
                          std::error_code &ec) {
         return JsonTrait<typename T::value_type>::getValue(data, *value, ec);
     }
+
+    template <class T>
+    static bool readValue(JsonReader *reader, T &value, std::error_code &ec) {
+        return JsonTrait<typename T::value_type>::readValue(reader, *value, ec);
+    }
 };
 
 template <>
 struct JsonTrait<JsonValue> {
-    template <class T>
-    static void putValue(JsonEncoder *encoder, T const &value) {
+    template <class Encoder, class T>
+    static void putValue(Encoder *encoder, T const &value) {
         std::visit([&](auto const &arg) {
             JsonTrait<std::decay_t<decltype(arg)>>::getValue(encoder, arg);
         }, value);
@@ -979,6 +2063,17 @@ struct JsonTrait<JsonValue> {
         value.inner = std::move(data);
         return true;
     }
+
+    // a JsonValue member still needs the tree, for that value only
+    static bool readValue(JsonReader *reader, JsonValue &value,
+                          std::error_code &ec) {
+        auto root = jsonParse(reader->json, ec);
+        if (!root) {
+            return false;
+        }
+        value.inner = std::move(root->inner);
+        return true;
+    }
 };
 
 template <class T>
@@ -996,6 +2091,10 @@ struct JsonTrait<std::array<T, N>> : JsonTraitArrayLike {};
 template <class T, class Alloc>
 struct JsonTrait<std::vector<T, Alloc>> : JsonTraitArrayLike {};
 
+// encode only, e.g. a slice of a vector
+template <class T, std::size_t Extent>
+struct JsonTrait<std::span<T, Extent>> : JsonTraitArrayLike {};
+
 template <class K, class V, class Cmp, class Alloc>
 struct JsonTrait<std::map<K, V, Cmp, Alloc>> : JsonTraitDictLike {};
 
@@ -1055,14 +2154,141 @@ struct JsonTrait<T, JsonValue> : JsonTraitJsonValueLike {};
 template <class T>
 struct JsonTrait<
     T, std::void_t<decltype(reflect_members(
-           std::declval<ReflectorJsonEncode &>(), std::declval<T &>()))>>
+           std::declval<ReflectorJsonEncode<JsonEncoder> &>(),
+           std::declval<T &>()))>>
     : JsonTraitObjectLike {};
 
+struct ReflectorJsonSizeHint {
+    std::size_t size = 1;
+
+    template <auto Member>
+    constexpr void field(char const *name) {
+        // "name":value,
+        size += std::char_traits<char>::length(name) + 4 +
+                jsonSizeHint<typename JsonMemberOf<decltype(Member)>::type>();
+    }
+};
+
+// a guess of the encoded size from the type alone, to reserve the output
+// once instead of growing it; the fields of a REFLECT type are summed up
 template <class T>
-inline std::string json_encode(T const &value) {
-    JsonEncoder encoder;
+constexpr std::size_t jsonSizeHint() {
+    using U = std::remove_cv_t<T>;
+    using Trait = JsonTrait<U>;
+    if constexpr (std::is_same_v<U, bool>) {
+        return 5;
+    } else if constexpr (std::is_integral_v<U>) {
+        return std::numeric_limits<U>::digits10 + 2;
+    } else if constexpr (std::is_floating_point_v<U>) {
+        return 24;
+    } else if constexpr (std::is_base_of_v<JsonTraitStringLike, Trait>) {
+        return 16;
+    } else if constexpr (std::is_base_of_v<JsonTraitOptionalLike, Trait>) {
+        return jsonSizeHint<typename U::value_type>();
+    } else if constexpr (JsonHasFields<U>::value) {
+        ReflectorJsonSizeHint reflector;
+        U::template REFLECT__FIELDS<U>(reflector);
+        return reflector.size;
+    } else if constexpr (std::is_base_of_v<JsonTraitDictLike, Trait>) {
+        return 32;
+    } else {
+        // arrays are reserved again once their size is known
+        return 16;
+    }
+}
+
+// appends the json to out, which keeps what it already holds
+template <class T, class Buffer>
+inline void json_encode(T const &value, Buffer &out) {
+    BasicJsonEncoder<Buffer> encoder(out);
+    encoder.reserve(jsonSizeHint<T>());
     encoder.putValue(value);
-    return encoder.json;
+}
+
+template <class T>
+inline std::string json_encode(T const &value) {
+    std::string json;
+    json_encode(value, json);
+    return json;
+}
+
+// whether the last reflected member of T has a Trait deriving from Base
+template <class Base, template <class, class> class Trait>
+struct ReflectorLastFieldIs {
+    bool value = false;
+
+    template <auto Member>
+    constexpr void field(char const *) {
+        using M = typename JsonMemberOf<decltype(Member)>::type;
+        value = std::is_base_of_v<Base, Trait<M, void>>;
+    }
+};
+
+// objects whose last member is an array are chunked too, e.g. a page of
+// results: the first chunk has the other members, the array is chunked
+template <class T, class Base, template <class, class> class Trait>
+inline constexpr bool chunkableLastField = [] {
+    if constexpr (JsonHasFields<T>::value) {
+        ReflectorLastFieldIs<Base, Trait> reflector;
+        T::template REFLECT__FIELDS<T>(reflector);
+        return reflector.value;
+    } else {
+        return false;
+    }
+}();
+
+template <class Encoder, class T>
+struct ReflectorJsonChunk {
+    Encoder *encoder;
+    T const *value;
+    std::size_t index;
+    std::size_t count;
+    std::size_t seen = 0;
+
+    template <auto Member>
+    void field(char const *name) {
+        using M = typename JsonMemberOf<decltype(Member)>::type;
+        bool last = ++seen == JsonFieldTable<T>::count;
+        if (index == 0) {
+            if (seen != 1) {
+                encoder->put(',');
+            }
+            encoder->putLiterialString(name);
+            encoder->put(':');
+            if (!last) {
+                JsonTrait<M>::putValue(encoder, value->*Member);
+            }
+        }
+        if constexpr (std::is_base_of_v<JsonTraitArrayLike, JsonTrait<M>>) {
+            if (last) {
+                JsonTraitArrayLike::putChunk(encoder, value->*Member, index, count);
+            }
+        }
+    }
+};
+
+// chunk index of count of an array (vector, array or span), or of an
+// object whose last member is one: each chunk can be encoded into its own
+// buffer, e.g. on its own thread, joined in order they are json_encode(value)
+template <class T, class Buffer>
+inline void json_encode_chunk(T const &value, std::size_t index,
+                              std::size_t count, Buffer &out) {
+    BasicJsonEncoder<Buffer> encoder(out);
+    if constexpr (std::is_base_of_v<JsonTraitArrayLike, JsonTrait<T>>) {
+        JsonTraitArrayLike::putChunk(&encoder, value, index, count);
+    } else {
+        static_assert(chunkableLastField<T, JsonTraitArrayLike, JsonTrait>,
+                      "only arrays, or objects ending with one, are chunked");
+        if (index == 0) {
+            encoder.put('{');
+        }
+        ReflectorJsonChunk<BasicJsonEncoder<Buffer>, T> reflector{
+            &encoder, &value, index, count};
+        T::template REFLECT__FIELDS<T>(reflector);
+        if (index + 1 == count) {
+            encoder.put('}');
+        }
+    }
 }
 
 template <class T>
@@ -1070,13 +2296,11 @@ inline bool json_decode(JsonValue &root, T &value, std::error_code &ec) {
     return JsonTrait<T>::getValue(root.inner, value, ec);
 }
 
+// decodes while scanning, without building a JsonValue tree
 template <class T>
 inline bool json_decode(std::string_view json, T &value, std::error_code &ec) {
-    auto root = jsonParse(json, ec);
-    if (!root) {
-        return false;
-    }
-    return json_decode(*root, value, ec);
+    JsonReader reader{json};
+    return JsonTrait<T>::readValue(&reader, value, ec);
 }
 
 template <class T>
@@ -1098,4 +2322,165 @@ inline T json_decode(std::string_view json) {
     }
     return value;
 }
+// a value of a json text that is only parsed where it is looked at: a
+// lookup skips the members before the one it wants without building them,
+// and get() decodes just the value it is called on, e.g.
+//     jsonLazy(body)["first"].get<std::int64_t>()
+// a failed lookup carries its error on, to whatever is looked up from it
+struct JsonLazy {
+    // from the start of the value to the end of the input
+    std::string_view json;
+    std::error_code ec{};
+
+    bool exists() const noexcept {
+        return !ec;
+    }
+
+    explicit operator bool() const noexcept {
+        return exists();
+    }
+
+    JsonLazy operator[](std::string_view key) const {
+        if (ec) {
+            return *this;
+        }
+        JsonReader reader{json};
+        std::error_code e;
+        if (reader.peek(e) != '{') {
+            return mismatch(reader, e);
+        }
+        reader.json.remove_prefix(1);
+        for (;;) {
+            int more = reader.next('}', e);
+            if (more <= 0) {
+                return {{}, more == 0 ? make_error_code(JsonError::NullEntry) : e};
+            }
+            std::string_view name;
+            if (!reader.readKey(name, e)) {
+                return {{}, e};
+            }
+            if (name == key) {
+                return from(reader, e);
+            }
+            if (!reader.skipValue(e)) {
+                return {{}, e};
+            }
+        }
+    }
+
+    JsonLazy operator[](std::size_t index) const {
+        if (ec) {
+            return *this;
+        }
+        JsonReader reader{json};
+        std::error_code e;
+        if (reader.peek(e) != '[') {
+            return mismatch(reader, e);
+        }
+        reader.json.remove_prefix(1);
+        for (std::size_t i = 0;; ++i) {
+            int more = reader.next(']', e);
+            if (more <= 0) {
+                return {{}, more == 0 ? make_error_code(JsonError::NullEntry) : e};
+            }
+            if (i == index) {
+                return from(reader, e);
+            }
+            if (!reader.skipValue(e)) {
+                return {{}, e};
+            }
+        }
+    }
+
+    // a json pointer (RFC 6901), e.g. "/messages/0/user", "" is this value
+    JsonLazy pointer(std::string_view path) const {
+        JsonLazy value = *this;
+        std::string token;
+        while (!path.empty() && value) {
+            if (path.front() != '/') {
+                return {{}, make_error_code(JsonError::UnexpectedToken)};
+            }
+            path.remove_prefix(1);
+            auto end = std::min(path.find('/'), path.size());
+            auto raw = path.substr(0, end);
+            path.remove_prefix(end);
+            // ~1 is '/' and ~0 is '~'
+            token.clear();
+            for (std::size_t i = 0; i < raw.size(); ++i) {
+                if (raw[i] == '~' && i + 1 < raw.size() &&
+                    (raw[i + 1] == '0' || raw[i + 1] == '1')) {
+                    token.push_back(raw[++i] == '0' ? '~' : '/');
+                } else {
+                    token.push_back(raw[i]);
+                }
+            }
+            std::error_code e;
+            JsonReader reader{value.json};
+            std::size_t index = 0;
+            auto res = std::from_chars(token.data(), token.data() + token.size(),
+                                       index);
+            if (reader.peek(e) == '[' && res.ec == std::errc() &&
+                res.ptr == token.data() + token.size()) {
+                value = value[index];
+            } else {
+                value = value[std::string_view(token)];
+            }
+        }
+        return value;
+    }
+
+    // the text of the value
+    std::string_view raw() const {
+        if (ec) {
+            return {};
+        }
+        JsonReader reader{json};
+        std::error_code e;
+        if (!reader.skipValue(e)) {
+            return {};
+        }
+        return json.substr(0, json.size() - reader.json.size());
+    }
+
+    template <class T>
+    bool get(T &value, std::error_code &e) const {
+        if (ec) {
+            e = ec;
+            return false;
+        }
+        JsonReader reader{json};
+        return JsonTrait<T>::readValue(&reader, value, e);
+    }
+
+    template <class T>
+    T get() const {
+        T value{};
+        std::error_code e;
+        if (!get(value, e)) [[unlikely]] {
+            throw std::system_error(e);
+        }
+        return value;
+    }
+
+    // the value at the front of reader
+    static JsonLazy from(JsonReader &reader, std::error_code &e) {
+        if (!reader.skipSpace(e)) {
+            return {{}, e};
+        }
+        return {reader.json};
+    }
+
+    static JsonLazy mismatch(JsonReader &reader, std::error_code &e) {
+        if (!e) {
+            reader.typeMismatch(e);
+        }
+        return {{}, e};
+    }
+};
+
+inline JsonLazy jsonLazy(std::string_view json) {
+    JsonReader reader{json};
+    std::error_code ec;
+    return JsonLazy::from(reader, ec);
+}
 } // namespace reflect
\ No newline at end of file
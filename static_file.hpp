@@ -0,0 +1,180 @@
+#pragma once
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include "io_context.hpp"
+#include "http_server.hpp"
+
+// serves the files under a directory with sendfile(), straight from the page
+// cache; the open fds and their stat are cached and only checked against the
+// file system again every revalidate interval
+// the cache is not thread safe: make one handler per reactor
+struct static_file_handler {
+    using clock = std::chrono::steady_clock;
+
+    struct _entry {
+        file_descriptor m_file;
+        size_t m_size = 0;
+        dev_t m_dev = 0;
+        ino_t m_ino = 0;
+        struct timespec m_mtime{};
+        std::string_view m_content_type;
+        clock::time_point m_checked;
+    };
+
+    struct _string_hash {
+        using is_transparent = void;
+
+        size_t operator()(std::string_view str) const noexcept {
+            return std::hash<std::string_view>{}(str);
+        }
+    };
+
+    struct _cache {
+        std::string m_root;
+        clock::duration m_revalidate;
+        size_t m_limit = 1024;
+        // keyed by the url path, an entry stays alive while a response
+        // still sends from its fd
+        std::unordered_map<std::string, std::shared_ptr<_entry>, _string_hash,
+                           std::equal_to<>> m_entries;
+    };
+
+    std::shared_ptr<_cache> m_cache;
+
+    explicit static_file_handler(
+        std::string root, clock::duration revalidate = std::chrono::seconds(1))
+        : m_cache(std::make_shared<_cache>()) {
+        m_cache->m_root = std::move(root);
+        m_cache->m_revalidate = revalidate;
+    }
+
+    void operator()(http_server::http_request &request) const {
+        auto entry = _lookup(request.path);
+        if (!entry) {
+            return request.write_response(404, "404 Not Found");
+        }
+        http_file_chunk file{entry->m_file.m_fd, 0, entry->m_size};
+        auto content_type = entry->m_content_type;
+        return request.write_file_response(200, file, std::move(entry),
+                                           content_type);
+    }
+
+    std::shared_ptr<_entry> _lookup(std::string_view path) const {
+        auto &entries = m_cache->m_entries;
+        auto now = clock::now();
+        auto it = entries.find(path);
+        if (it != entries.end()) {
+            auto &entry = it->second;
+            if (now - entry->m_checked < m_cache->m_revalidate) {
+                return entry;
+            }
+            // revalidate: reopen if the file was replaced or modified
+            struct stat st;
+            if (stat(_file_path(path).c_str(), &st) == 0 &&
+                _same_file(*entry, st)) {
+                entry->m_checked = now;
+                return entry;
+            }
+            entries.erase(it);
+        }
+        if (!_is_safe(path)) {
+            return nullptr;
+        }
+        auto entry = _open(_file_path(path));
+        if (!entry) {
+            return nullptr;
+        }
+        entry->m_checked = now;
+        if (entries.size() >= m_cache->m_limit) {
+            entries.clear();
+        }
+        entries.emplace(path, entry);
+        return entry;
+    }
+
+    std::string _file_path(std::string_view path) const {
+        std::string file_path = m_cache->m_root;
+        file_path.append(path);
+        if (file_path.back() == '/') {
+            file_path.append("index.html");
+        }
+        return file_path;
+    }
+
+    static bool _is_safe(std::string_view path) noexcept {
+        if (path.empty() || path.front() != '/' ||
+            path.find('\0') != path.npos) {
+            return false;
+        }
+        // no ".." segment, the file must stay under the root
+        for (size_t pos = path.find("/.."); pos != path.npos;
+             pos = path.find("/..", pos + 1)) {
+            if (pos + 3 == path.size() || path[pos + 3] == '/') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool _same_file(_entry const &entry, struct stat const &st) noexcept {
+        return entry.m_dev == st.st_dev && entry.m_ino == st.st_ino &&
+               entry.m_size == static_cast<size_t>(st.st_size) &&
+               entry.m_mtime.tv_sec == st.st_mtim.tv_sec &&
+               entry.m_mtime.tv_nsec == st.st_mtim.tv_nsec;
+    }
+
+    static std::shared_ptr<_entry> _open(std::string const &file_path) {
+        int fd = open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            return nullptr;
+        }
+        auto entry = std::make_shared<_entry>();
+        entry->m_file = file_descriptor{fd};
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return nullptr;
+        }
+        entry->m_size = static_cast<size_t>(st.st_size);
+        entry->m_dev = st.st_dev;
+        entry->m_ino = st.st_ino;
+        entry->m_mtime = st.st_mtim;
+        entry->m_content_type = content_type_of(file_path);
+        return entry;
+    }
+
+    static std::string_view content_type_of(std::string_view file_path) noexcept {
+        static constexpr std::pair<std::string_view, std::string_view> types[] = {
+            {".html", "text/html;charset=utf-8"},
+            {".htm", "text/html;charset=utf-8"},
+            {".js", "text/javascript"},
+            {".css", "text/css"},
+            {".json", "application/json"},
+            {".txt", "text/plain;charset=utf-8"},
+            {".svg", "image/svg+xml"},
+            {".png", "image/png"},
+            {".jpg", "image/jpeg"},
+            {".jpeg", "image/jpeg"},
+            {".gif", "image/gif"},
+            {".ico", "image/x-icon"},
+            {".wasm", "application/wasm"},
+        };
+        auto dot = file_path.rfind('.');
+        if (dot != file_path.npos && file_path.find('/', dot) == file_path.npos) {
+            auto ext = file_path.substr(dot);
+            for (auto &[suffix, type]: types) {
+                if (ext == suffix) {
+                    return type;
+                }
+            }
+        }
+        return "application/octet-stream";
+    }
+};
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include "block_pool.hpp"
 #include "callback.hpp"
 
 struct stop_source {
@@ -14,7 +15,8 @@ struct stop_source {
     stop_source() = default;
 
     explicit stop_source(std::in_place_t)
-        : m_control(std::make_shared<_control_block>()) {}
+        : m_control(std::allocate_shared<_control_block>(
+              block_pool_allocator<_control_block>{})) {}
 
     static stop_source make() {
         return stop_source(std::in_place);
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "callback.hpp"
+
+// worker threads for cpu heavy work that would stall a reactor (e.g. encoding
+// a large response), a task that has to resume a reactor post()s back to its
+// io_context
+// a task is destroyed on the worker that ran it: keep its captures small
+// enough to be stored inline, or its block ends up in the worker's pool
+struct thread_pool {
+    std::vector<std::thread> m_threads;
+    std::mutex m_lock;
+    std::condition_variable m_ready;
+    std::deque<callback<>> m_tasks;
+    bool m_stop = false;
+
+    explicit thread_pool(size_t n = default_concurrency()) {
+        m_threads.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            m_threads.emplace_back([this] { _run(); });
+        }
+    }
+
+    thread_pool(thread_pool &&) = delete;
+
+    static size_t default_concurrency() noexcept {
+        size_t n = std::thread::hardware_concurrency();
+        return n == 0 ? 1 : n;
+    }
+
+    size_t size() const noexcept {
+        return m_threads.size();
+    }
+
+    // thread safe, tasks start in submit order
+    void submit(callback<> task) {
+        {
+            std::lock_guard guard(m_lock);
+            m_tasks.push_back(std::move(task));
+        }
+        m_ready.notify_one();
+    }
+
+    void _run() {
+        while (true) {
+            callback<> task;
+            {
+                std::unique_lock guard(m_lock);
+                m_ready.wait(guard, [this] { return m_stop || !m_tasks.empty(); });
+                if (m_tasks.empty()) {
+                    return;
+                }
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task();
+        }
+    }
+
+    // the tasks already submitted are run first
+    ~thread_pool() {
+        {
+            std::lock_guard guard(m_lock);
+            m_stop = true;
+        }
+        m_ready.notify_all();
+        for (auto &t: m_threads) {
+            t.join();
+        }
+    }
+};
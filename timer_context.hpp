@@ -1,50 +1,209 @@
 #pragma once
 
-#include <map>
+#include <array>
 #include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
 #include "callback.hpp"
 #include "stop_source.hpp"
 
+// hierarchical timing wheel: 11 levels of 64 slots with a 1ms tick cover
+// the whole 64-bit tick range, arming and cancelling are O(1)
 struct timer_context {
-    struct _timer_entry {
+    static constexpr unsigned _slot_bits = 6;
+    static constexpr unsigned _slots = 1u << _slot_bits;
+    static constexpr unsigned _levels = 11;
+    static constexpr size_t _entries_per_chunk = 64;
+
+    using clock = std::chrono::steady_clock;
+    using tick_duration = std::chrono::milliseconds;
+
+    struct _timer_link {
+        _timer_link *m_prev = this;
+        _timer_link *m_next = this;
+
+        bool empty() const noexcept {
+            return m_next == this;
+        }
+    };
+
+    // intrusive entries, recycled through m_free
+    struct _timer_entry : _timer_link {
+        uint64_t m_expire = 0;
+        unsigned m_level = 0;
+        unsigned m_slot = 0;
         callback<> m_call;
         stop_source m_stop;
     };
 
-    std::multimap<std::chrono::steady_clock::time_point, _timer_entry>
-        m_timer_heap;
+    std::array<std::array<_timer_link, _slots>, _levels> m_wheel;
+    std::array<uint64_t, _levels> m_bitmap{};
+    std::vector<std::unique_ptr<_timer_entry[]>> m_chunks;
+    _timer_entry *m_free = nullptr;
+    size_t m_count = 0;
+    // all the entries expiring at or before m_curr have been fired
+    uint64_t m_curr = 0;
+    clock::time_point m_base = clock::now();
 
     timer_context() = default;
     timer_context(timer_context &&) = delete;
 
-    void set_timeout(std::chrono::steady_clock::duration dt, callback<> call,
+    uint64_t _to_tick(clock::time_point t) const noexcept {
+        return static_cast<uint64_t>(
+            std::chrono::duration_cast<tick_duration>(t - m_base).count());
+    }
+
+    void set_timeout(clock::duration dt, callback<> call,
         stop_source stop = {}) {
-        auto expire_time = std::chrono::steady_clock::now() + dt;
-        auto it = m_timer_heap.insert(
-            {expire_time, _timer_entry{std::move(call), stop}});
-        stop.set_stop_callback([this, it] {
-            auto call = std::move(it->second.m_call);
-            m_timer_heap.erase(it);
+        auto ticks = std::chrono::ceil<tick_duration>(dt).count();
+        _timer_entry *e = _alloc_entry();
+        // never earlier than asked: round up, and the tick of now is floored
+        uint64_t expire = _to_tick(clock::now()) + static_cast<uint64_t>(ticks) + 1;
+        e->m_expire = expire > m_curr ? expire : m_curr + 1;
+        e->m_call = std::move(call);
+        e->m_stop = stop;
+        _insert(e);
+        stop.set_stop_callback([this, e] {
+            auto call = std::move(e->m_call);
+            _unlink(e);
+            _free_entry(e);
             call();
         });
     }
 
     std::chrono::steady_clock::duration duration_to_next_timer() {
-        for (auto it = m_timer_heap.begin(); it != m_timer_heap.end(); it = m_timer_heap.erase(it)) {
-            auto now = std::chrono::steady_clock::now();
-            if (it->first <= now) {
-                // if timer was expired, callback and erase
-                it->second.m_stop.clear_stop_callback();
-                auto call = std::move(it->second.m_call);
-                call();
+        if (m_count == 0) {
+            return std::chrono::nanoseconds(-1);
+        }
+        // the clock is read once, not once per expired entry
+        auto now = clock::now();
+        _advance(_to_tick(now));
+        uint64_t next;
+        if (!_next_slot(nullptr, nullptr, &next)) {
+            return std::chrono::nanoseconds(-1);
+        }
+        // for the upper levels this is the start of the slot, the loop will
+        // wake up there and cascade it down
+        return m_base + tick_duration(next) - now;
+    }
+
+    bool is_empty() const {
+        return m_count == 0;
+    }
+
+    _timer_entry *_alloc_entry() {
+        if (!m_free) {
+            auto chunk = std::make_unique<_timer_entry[]>(_entries_per_chunk);
+            for (size_t i = 0; i < _entries_per_chunk; i++) {
+                chunk[i].m_next = i + 1 < _entries_per_chunk ? &chunk[i + 1] : nullptr;
+            }
+            m_free = &chunk[0];
+            m_chunks.push_back(std::move(chunk));
+        }
+        _timer_entry *e = m_free;
+        m_free = static_cast<_timer_entry *>(e->m_next);
+        ++m_count;
+        return e;
+    }
+
+    void _free_entry(_timer_entry *e) noexcept {
+        e->m_call = nullptr;
+        e->m_stop = {};
+        e->m_prev = nullptr;
+        e->m_next = m_free;
+        m_free = e;
+        --m_count;
+    }
+
+    void _insert(_timer_entry *e) noexcept {
+        // the level is the highest 6-bit group where expire and now differ
+        uint64_t diff = e->m_expire ^ m_curr;
+        unsigned level = diff == 0 ? 0 : (63 - __builtin_clzll(diff)) / _slot_bits;
+        unsigned slot = (e->m_expire >> (level * _slot_bits)) & (_slots - 1);
+        e->m_level = level;
+        e->m_slot = slot;
+        _timer_link &head = m_wheel[level][slot];
+        e->m_prev = head.m_prev;
+        e->m_next = &head;
+        head.m_prev->m_next = e;
+        head.m_prev = e;
+        m_bitmap[level] |= uint64_t(1) << slot;
+    }
+
+    void _unlink(_timer_entry *e) noexcept {
+        e->m_prev->m_next = e->m_next;
+        e->m_next->m_prev = e->m_prev;
+        if (m_wheel[e->m_level][e->m_slot].empty()) {
+            m_bitmap[e->m_level] &= ~(uint64_t(1) << e->m_slot);
+        }
+    }
+
+    // finds the first pending slot after m_curr, start is the first tick
+    // the slot covers (exact for level 0)
+    bool _next_slot(unsigned *plevel, unsigned *pslot, uint64_t *pstart) const noexcept {
+        for (unsigned level = 0; level < _levels; level++) {
+            unsigned shift = level * _slot_bits;
+            unsigned index = (m_curr >> shift) & (_slots - 1);
+            uint64_t mask = m_bitmap[level];
+            if (level == 0) {
+                mask &= ~uint64_t(0) << index;
             } else {
-                return it->first - now;
+                mask &= index + 1 == _slots ? 0 : ~uint64_t(0) << (index + 1);
+            }
+            if (mask) {
+                unsigned slot = __builtin_ctzll(mask);
+                unsigned upper = shift + _slot_bits;
+                uint64_t start = upper >= 64 ? 0 : (m_curr >> upper) << upper;
+                start |= uint64_t(slot) << shift;
+                if (plevel) {
+                    *plevel = level;
+                    *pslot = slot;
+                }
+                *pstart = start;
+                return true;
             }
         }
-        return std::chrono::nanoseconds(-1);
+        return false;
     }
 
-    bool is_empty() const {
-        return m_timer_heap.empty();
+    // fires every timer expiring at or before target
+    void _advance(uint64_t target) {
+        unsigned level, slot;
+        uint64_t start;
+        while (m_count != 0 && _next_slot(&level, &slot, &start) &&
+               start <= target) {
+            m_curr = start;
+            _timer_link &head = m_wheel[level][slot];
+            if (level == 0) {
+                while (!head.empty()) {
+                    auto e = static_cast<_timer_entry *>(head.m_next);
+                    _unlink(e);
+                    // if timer was expired, callback and erase
+                    e->m_stop.clear_stop_callback();
+                    auto call = std::move(e->m_call);
+                    _free_entry(e);
+                    call();
+                }
+            } else {
+                // cascade the slot down to the lower levels
+                _timer_link pending;
+                pending.m_next = head.m_next;
+                pending.m_prev = head.m_prev;
+                pending.m_next->m_prev = &pending;
+                pending.m_prev->m_next = &pending;
+                head.m_next = head.m_prev = &head;
+                m_bitmap[level] &= ~(uint64_t(1) << slot);
+                while (!pending.empty()) {
+                    auto e = static_cast<_timer_entry *>(pending.m_next);
+                    pending.m_next = e->m_next;
+                    e->m_next->m_prev = &pending;
+                    _insert(e);
+                }
+            }
+        }
+        if (target > m_curr) {
+            m_curr = target;
+        }
     }
-};
\ No newline at end of file
+};
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "bytes_buffer.hpp"
+#include "callback.hpp"
+#include "io_context.hpp"
+#include "stop_source.hpp"
+#include "write_queue.hpp"
+
+// sha-1 (FIPS 180-4), only for the Sec-WebSocket-Accept of the handshake
+inline std::array<unsigned char, 20> sha1(std::string_view data) {
+    std::uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476,
+                          0xC3D2E1F0};
+    auto rotl = [](std::uint32_t x, int n) {
+        return (x << n) | (x >> (32 - n));
+    };
+    auto block = [&](unsigned char const *p) {
+        std::uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            w[i] = std::uint32_t(p[4 * i]) << 24 | std::uint32_t(p[4 * i + 1]) << 16 |
+                   std::uint32_t(p[4 * i + 2]) << 8 | std::uint32_t(p[4 * i + 3]);
+        }
+        for (int i = 16; i < 80; i++) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            std::uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            std::uint32_t t = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    };
+    auto p = reinterpret_cast<unsigned char const *>(data.data());
+    size_t n = data.size();
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        block(p + i);
+    }
+    // the rest, 0x80, zeros, and the length in bits on the last 8 bytes
+    unsigned char tail[128] = {};
+    size_t rest = n - i;
+    std::memcpy(tail, p + i, rest);
+    tail[rest] = 0x80;
+    size_t tail_size = rest + 9 <= 64 ? 64 : 128;
+    std::uint64_t bits = std::uint64_t(n) * 8;
+    for (size_t j = 0; j < 8; j++) {
+        tail[tail_size - 1 - j] = static_cast<unsigned char>(bits >> (8 * j));
+    }
+    block(tail);
+    if (tail_size == 128) {
+        block(tail + 64);
+    }
+    std::array<unsigned char, 20> digest;
+    for (size_t j = 0; j < 20; j++) {
+        digest[j] = static_cast<unsigned char>(h[j / 4] >> (24 - 8 * (j % 4)));
+    }
+    return digest;
+}
+
+inline std::string base64_encode(std::string_view data) {
+    static constexpr char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    auto p = reinterpret_cast<unsigned char const *>(data.data());
+    std::string out;
+    out.reserve((data.size() + 2) / 3 * 4);
+    size_t i = 0;
+    for (; i + 3 <= data.size(); i += 3) {
+        std::uint32_t v = std::uint32_t(p[i]) << 16 | std::uint32_t(p[i + 1]) << 8 | p[i + 2];
+        out.push_back(digits[v >> 18]);
+        out.push_back(digits[(v >> 12) & 63]);
+        out.push_back(digits[(v >> 6) & 63]);
+        out.push_back(digits[v & 63]);
+    }
+    if (size_t rest = data.size() - i) {
+        std::uint32_t v = std::uint32_t(p[i]) << 16;
+        if (rest == 2) {
+            v |= std::uint32_t(p[i + 1]) << 8;
+        }
+        out.push_back(digits[v >> 18]);
+        out.push_back(digits[(v >> 12) & 63]);
+        out.push_back(rest == 2 ? digits[(v >> 6) & 63] : '=');
+        out.push_back('=');
+    }
+    return out;
+}
+
+// the Sec-WebSocket-Accept answering a Sec-WebSocket-Key
+inline std::string websocket_accept_key(std::string_view key) {
+    std::string text(key);
+    text += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    auto digest = sha1(text);
+    return base64_encode(std::string_view(
+        reinterpret_cast<char const *>(digest.data()), digest.size()));
+}
+
+// xors data with the masking key repeated from its first byte, key holds
+// the 4 bytes as they are on the wire: masks and unmasks alike
+inline void websocket_mask(char *data, size_t n, std::uint32_t key) noexcept {
+    size_t i = 0;
+    // every step below is a multiple of 4 bytes, the key stays in phase
+#if defined(__AVX2__)
+    __m256i key32 = _mm256_set1_epi32(static_cast<int>(key));
+    for (; i + 32 <= n; i += 32) {
+        auto p = reinterpret_cast<__m256i *>(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), key32));
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i key16 = _mm_set1_epi32(static_cast<int>(key));
+    for (; i + 16 <= n; i += 16) {
+        auto p = reinterpret_cast<__m128i *>(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), key16));
+    }
+#endif
+    std::uint64_t key8 = std::uint64_t(key) << 32 | key;
+    for (; i + 8 <= n; i += 8) {
+        std::uint64_t v;
+        std::memcpy(&v, data + i, 8);
+        v ^= key8;
+        std::memcpy(data + i, &v, 8);
+    }
+    auto key_bytes = reinterpret_cast<char const *>(&key);
+    for (; i < n; ++i) {
+        data[i] ^= key_bytes[i % 4];
+    }
+}
+
+// strict utf-8: no overlong forms, surrogates, or code points past U+10FFFF
+inline bool utf8_valid(std::string_view s) noexcept {
+    auto p = reinterpret_cast<unsigned char const *>(s.data());
+    size_t n = s.size();
+    size_t i = 0;
+    while (i < n) {
+        // ascii runs 8 bytes at a time
+        if (i + 8 <= n) {
+            std::uint64_t v;
+            std::memcpy(&v, p + i, 8);
+            if (!(v & 0x8080808080808080)) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned c = p[i];
+        if (c < 0x80) {
+            ++i;
+            continue;
+        }
+        size_t len;
+        // the range of the second byte
+        unsigned lo = 0x80, hi = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            len = 2;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            len = 3;
+            lo = c == 0xE0 ? 0xA0 : lo;
+            hi = c == 0xED ? 0x9F : hi;
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            len = 4;
+            lo = c == 0xF0 ? 0x90 : lo;
+            hi = c == 0xF4 ? 0x8F : hi;
+        } else {
+            return false;
+        }
+        if (n - i < len || p[i + 1] < lo || p[i + 1] > hi) {
+            return false;
+        }
+        for (size_t j = 2; j < len; j++) {
+            if ((p[i + j] & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        i += len;
+    }
+    return true;
+}
+
+// the server end of a websocket (RFC 6455), made by the handshake of
+// http_router::route_websocket and started on the socket once the 101
+// response is written; frames queued before are sent then
+// a client frame is unmasked in place in the read buffer, a message in a
+// single frame is handed out from there without copy
+// a ping goes out every ping interval, a peer silent for a whole interval
+// is dropped, and so is one that does not answer a close within one
+struct websocket : std::enable_shared_from_this<websocket>,
+                   write_queue<websocket> {
+    using pointer = std::shared_ptr<websocket>;
+
+    enum class opcode : std::uint8_t {
+        continuation = 0,
+        text = 1,
+        binary = 2,
+        close = 8,
+        ping = 9,
+        pong = 10,
+    };
+
+    // the read side, write_queue writes through a dup() of it
+    async_file m_conn;
+    bytes_buffer m_readbuf{4096};
+    size_t m_read_size = 0;
+    size_t m_consumed = 0;
+    // the size of the frame being read, once its header is in
+    size_t m_wanted = 0;
+    // a fragmented message, until its last frame
+    std::string m_message;
+    opcode m_message_op = opcode::text;
+    bool m_in_message = false;
+    size_t m_max_message = 1024 * 1024;
+
+    stop_source m_stop_read{std::in_place};
+    stop_source m_stop_ping;
+    std::chrono::steady_clock::duration m_ping_interval = std::chrono::seconds(30);
+    // something came from the peer since the last ping
+    bool m_received = true;
+
+    bool m_close_sent = false;
+    // nothing more is read: the peer's close came, or it broke the protocol
+    bool m_read_closed = false;
+    bool m_closed = false;
+    std::uint16_t m_close_code = 1005;
+
+    callback<websocket &, opcode, std::string_view> m_on_message;
+    callback<websocket &, std::uint16_t> m_on_close;
+
+    static pointer make() {
+        return std::make_shared<websocket>();
+    }
+
+    // a text or binary message, the view is only valid during the call
+    void on_message(callback<websocket &, opcode, std::string_view> call) {
+        m_on_message = std::move(call);
+    }
+
+    // once the socket is closed, with the close code (1006: dropped)
+    void on_close(callback<websocket &, std::uint16_t> call) {
+        m_on_close = std::move(call);
+    }
+
+    void set_ping_interval(std::chrono::steady_clock::duration dt) {
+        m_ping_interval = dt;
+    }
+
+    void set_max_message_size(size_t n) {
+        m_max_message = n;
+    }
+
+    bool is_closed() const noexcept {
+        return m_closed;
+    }
+
+    // a frame as the server sends it: unmasked, the same for every client
+    static std::string make_frame(opcode op, std::string_view payload) {
+        std::string frame;
+        frame.reserve(payload.size() + 10);
+        frame.push_back(static_cast<char>(0x80 | static_cast<std::uint8_t>(op)));
+        if (payload.size() < 126) {
+            frame.push_back(static_cast<char>(payload.size()));
+        } else if (payload.size() <= 0xFFFF) {
+            frame.push_back(126);
+            frame.push_back(static_cast<char>(payload.size() >> 8));
+            frame.push_back(static_cast<char>(payload.size()));
+        } else {
+            frame.push_back(127);
+            for (int i = 7; i >= 0; i--) {
+                frame.push_back(static_cast<char>(std::uint64_t(payload.size()) >> (8 * i)));
+            }
+        }
+        frame.append(payload);
+        return frame;
+    }
+
+    void send(std::string_view payload, opcode op = opcode::text) {
+        if (m_close_sent || m_closed) {
+            return;
+        }
+        _queue({make_frame(op, payload), nullptr});
+        _flush();
+    }
+
+    // a frame from make_frame(), shared with other sockets
+    void send_frame(std::shared_ptr<std::string const> frame) {
+        if (m_close_sent || m_closed) {
+            return;
+        }
+        _queue({{}, std::move(frame)});
+        _flush();
+    }
+
+    // starts the closing handshake, the socket is closed once the peer
+    // answers (or after a ping interval)
+    void close(std::uint16_t code = 1000, std::string_view reason = {}) {
+        if (m_close_sent || m_closed) {
+            return;
+        }
+        if (!m_read_closed) {
+            m_close_code = code;
+        }
+        std::string payload;
+        payload.push_back(static_cast<char>(code >> 8));
+        payload.push_back(static_cast<char>(code));
+        payload.append(reason.substr(0, 123));
+        _queue({make_frame(opcode::close, payload), nullptr});
+        m_close_sent = true;
+        _flush();
+        _maybe_finish();
+    }
+
+    // the socket of the upgraded connection, and the bytes already read
+    // past its http request
+    void do_start(async_file conn, std::string_view rest) {
+        if (conn.m_fd == -1) {
+            // the 101 response could not be written
+            return _shutdown(1006);
+        }
+        m_conn = std::move(conn);
+        if (m_readbuf.size() < rest.size() + 1) {
+            m_readbuf.resize(rest.size() + 1);
+        }
+        std::copy(rest.begin(), rest.end(), m_readbuf.data());
+        m_read_size = rest.size();
+        _arm_ping();
+        _start_output(m_conn);
+        if (_parse()) {
+            do_read();
+        }
+    }
+
+    void do_read() {
+        _compact();
+        m_conn.async_read(
+            m_readbuf.subspan(m_read_size, m_readbuf.size() - m_read_size),
+            [self = shared_from_this()](expected<size_t> ret) {
+                if (self->m_closed) {
+                    return;
+                }
+                if (ret.error() || ret.value() == 0) {
+                    return self->_shutdown(1006);
+                }
+                self->m_received = true;
+                self->m_read_size += ret.value();
+                if (self->_parse()) {
+                    return self->do_read();
+                }
+            },
+            m_stop_read);
+    }
+
+    // moves the partial frame to the front, and makes room for all of it
+    void _compact() {
+        if (m_consumed != 0) {
+            std::copy(m_readbuf.begin() + m_consumed,
+                      m_readbuf.begin() + m_read_size, m_readbuf.begin());
+            m_read_size -= m_consumed;
+            m_consumed = 0;
+        }
+        size_t wanted = std::max(m_wanted, m_read_size + 1);
+        if (wanted > m_readbuf.size()) {
+            m_readbuf.resize(std::max(wanted, m_readbuf.size() * 2));
+        }
+    }
+
+    // handles every complete frame read, returns false once nothing more
+    // is to be read
+    bool _parse() {
+        while (!m_read_closed && !m_closed) {
+            auto p = reinterpret_cast<unsigned char *>(m_readbuf.data()) + m_consumed;
+            size_t avail = m_read_size - m_consumed;
+            if (avail < 2) {
+                break;
+            }
+            bool fin = p[0] & 0x80;
+            unsigned op = p[0] & 0x0F;
+            std::uint64_t len = p[1] & 0x7F;
+            size_t head = 2;
+            if (len == 126) {
+                head = 4;
+                if (avail < head) {
+                    break;
+                }
+                len = std::uint64_t(p[2]) << 8 | p[3];
+            } else if (len == 127) {
+                head = 10;
+                if (avail < head) {
+                    break;
+                }
+                len = 0;
+                for (size_t i = 2; i < 10; i++) {
+                    len = len << 8 | p[i];
+                }
+            }
+            // no extension is negotiated, and a client always masks
+            if ((p[0] & 0x70) || !(p[1] & 0x80) ||
+                (op > 2 && op < 8) || op > 10 ||
+                (op >= 8 && (!fin || len > 125))) {
+                return _fail(1002);
+            }
+            if (len > m_max_message - std::min(m_message.size(), m_max_message)) {
+                return _fail(1009);
+            }
+            head += 4;
+            if (avail < head + len) {
+                m_wanted = head + len;
+                break;
+            }
+            m_wanted = 0;
+            std::uint32_t key;
+            std::memcpy(&key, p + head - 4, 4);
+            char *payload = reinterpret_cast<char *>(p) + head;
+            websocket_mask(payload, len, key);
+            m_consumed += head + len;
+            if (!_on_frame(fin, static_cast<opcode>(op), std::string_view(payload, len))) {
+                return false;
+            }
+        }
+        return !m_read_closed && !m_closed;
+    }
+
+    bool _on_frame(bool fin, opcode op, std::string_view payload) {
+        switch (op) {
+        case opcode::ping:
+            if (!m_close_sent) {
+                _queue({make_frame(opcode::pong, payload), nullptr});
+                _flush();
+            }
+            return true;
+        case opcode::pong:
+            return true;
+        case opcode::close:
+            return _on_close_frame(payload);
+        case opcode::continuation:
+            if (!m_in_message) {
+                return _fail(1002);
+            }
+            break;
+        default:
+            if (m_in_message) {
+                return _fail(1002);
+            }
+            if (fin) {
+                // the whole message in one frame, handed out in place
+                return _deliver(op, payload);
+            }
+            m_message_op = op;
+            m_in_message = true;
+            break;
+        }
+        m_message.append(payload);
+        if (!fin) {
+            return true;
+        }
+        m_in_message = false;
+        bool ok = _deliver(m_message_op, m_message);
+        m_message.clear();
+        return ok;
+    }
+
+    bool _deliver(opcode op, std::string_view message) {
+        if (op == opcode::text && !utf8_valid(message)) {
+            return _fail(1007);
+        }
+        // moved out for the call: a failed send may close the socket,
+        // which drops the callbacks
+        auto on_message = std::move(m_on_message);
+        if (on_message) {
+            on_message(multishot_call, *this, op, message);
+        }
+        if (!m_closed && !m_on_message) {
+            m_on_message = std::move(on_message);
+        }
+        return !m_closed;
+    }
+
+    bool _on_close_frame(std::string_view payload) {
+        std::uint16_t code = 1005;
+        if (payload.size() == 1) {
+            return _fail(1002);
+        }
+        if (payload.size() >= 2) {
+            code = static_cast<std::uint16_t>(
+                static_cast<unsigned char>(payload[0]) << 8 |
+                static_cast<unsigned char>(payload[1]));
+            bool valid = (code >= 1000 && code <= 1003) ||
+                         (code >= 1007 && code <= 1011) ||
+                         (code >= 3000 && code <= 4999);
+            if (!valid) {
+                return _fail(1002);
+            }
+            if (!utf8_valid(payload.substr(2))) {
+                return _fail(1007);
+            }
+        }
+        m_read_closed = true;
+        if (!m_close_sent) {
+            m_close_code = code;
+            // the echo of the peer's close
+            close(code == 1005 ? 1000 : code);
+        }
+        _maybe_finish();
+        return false;
+    }
+
+    // the peer broke the protocol: close with code, without waiting for it
+    bool _fail(std::uint16_t code) {
+        close(code);
+        m_read_closed = true;
+        _maybe_finish();
+        return false;
+    }
+
+    void _on_write_failed() {
+        _shutdown(1006);
+    }
+
+    void _on_written() {
+        _maybe_finish();
+    }
+
+    // both closes are done and written: the server closes the tcp first
+    void _maybe_finish() {
+        if (m_close_sent && m_read_closed && _output_idle()) {
+            _shutdown(m_close_code);
+        }
+    }
+
+    void _arm_ping() {
+        m_stop_ping = stop_source(std::in_place);
+        io_context::get().set_timeout(
+            m_ping_interval,
+            [self = shared_from_this()] {
+                // also called when the timer is stopped
+                if (self->m_closed) {
+                    return;
+                }
+                if (!self->m_received || self->m_close_sent) {
+                    // a dead peer, or one that does not answer the close
+                    return self->_shutdown(1006);
+                }
+                self->m_received = false;
+                self->_queue({make_frame(opcode::ping, {}), nullptr});
+                self->_flush();
+                self->_arm_ping();
+            },
+            m_stop_ping);
+    }
+
+    void _shutdown(std::uint16_t code) {
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+        m_stop_read.request_stop();
+        m_stop_ping.request_stop();
+        _stop_output();
+        m_conn = async_file{};
+        m_on_message = nullptr;
+        auto on_close = std::move(m_on_close);
+        if (on_close) {
+            on_close(*this, code);
+        }
+    }
+};
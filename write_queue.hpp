@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "callback.hpp"
+#include "io_context.hpp"
+#include "stop_source.hpp"
+
+// the output of a connection that left http (websocket, event stream):
+// what is sent is queued, each chunk owned or shared with other streams, and
+// the queue is written in one writev per batch
+// the socket is written through a dup() of it: epoll has a single
+// registration per fd, and the derived stream waits on reads at the same
+// time; both are closed in the same call (_stop_output() next to closing
+// the read side), epoll forgets them only once the socket is closed, and a
+// write still in flight keeps m_sending alive through the stream
+// Derived is shared_from_this() and has:
+//     void _on_write_failed();  // the socket is broken
+//     void _on_written();       // a batch is written, the next one started
+template <class Derived>
+struct write_queue {
+    // an outgoing chunk (a frame, an event), owned or shared
+    struct chunk {
+        std::string m_owned;
+        std::shared_ptr<std::string const> m_shared;
+
+        std::string_view data() const noexcept {
+            if (m_shared) {
+                return *m_shared;
+            }
+            return m_owned;
+        }
+    };
+
+    async_file m_conn_out;
+    // m_queue waits for the write of m_sending to finish
+    std::vector<chunk> m_queue;
+    std::vector<chunk> m_sending;
+    std::vector<struct iovec> m_iov;
+    size_t m_iov_done = 0;
+    size_t m_buffered = 0;
+    // every byte written so far
+    std::uint64_t m_bytes_written = 0;
+    bool m_writing = false;
+    // sends only queue until uncork()
+    bool m_corked = false;
+    // between _start_output() and _stop_output()
+    bool m_output_open = false;
+    stop_source m_stop_write{std::in_place};
+
+    // the bytes queued and not written yet, for backpressure
+    size_t buffered_amount() const noexcept {
+        return m_buffered;
+    }
+
+    // queues what is sent until uncork(), to write a batch of it at once
+    // instead of one syscall each
+    void cork() noexcept {
+        m_corked = true;
+    }
+
+    void uncork() {
+        m_corked = false;
+        _flush();
+    }
+
+    // nothing is queued or being written
+    bool _output_idle() const noexcept {
+        return !m_writing && m_queue.empty();
+    }
+
+    void _queue(chunk c) {
+        m_buffered += c.data().size();
+        m_queue.push_back(std::move(c));
+    }
+
+    // what was queued before is written from now on
+    void _start_output(async_file const &conn) {
+        m_conn_out = async_file{convert_error(dup(conn.m_fd)).expect("dup")};
+        m_output_open = true;
+        _flush();
+    }
+
+    void _stop_output() {
+        m_output_open = false;
+        m_stop_write.request_stop();
+        m_conn_out = async_file{};
+        m_queue.clear();
+        m_buffered = 0;
+    }
+
+    void _flush() {
+        if (!m_output_open || m_writing || m_corked || m_queue.empty()) {
+            return;
+        }
+        m_sending.clear();
+        std::swap(m_sending, m_queue);
+        m_iov.clear();
+        for (auto &c: m_sending) {
+            auto data = c.data();
+            m_iov.push_back({const_cast<char *>(data.data()), data.size()});
+        }
+        m_iov_done = 0;
+        m_writing = true;
+        _writev();
+    }
+
+    void _writev() {
+        size_t count = std::min<size_t>(m_iov.size() - m_iov_done, IOV_MAX);
+        m_conn_out.async_writev(
+            m_iov.data() + m_iov_done, count,
+            [self = static_cast<Derived *>(this)->shared_from_this()](
+                expected<size_t> ret) {
+                write_queue &out = *self;
+                if (!out.m_output_open) {
+                    return;
+                }
+                if (ret.error() || ret.value() == 0) {
+                    return self->_on_write_failed();
+                }
+                out.m_buffered -= ret.value();
+                out.m_bytes_written += ret.value();
+                if (!async_file::consume_iov(out.m_iov, out.m_iov_done,
+                                             ret.value())) {
+                    return out._writev();
+                }
+                out.m_writing = false;
+                out._flush();
+                self->_on_written();
+            },
+            m_stop_write);
+    }
+};